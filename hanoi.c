@@ -0,0 +1,3178 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "hanoi.h"
+
+// Strings used for rendering
+#define EMPTY " "
+#define DISK "█"
+#define ROD "│"
+#define UPPER_HALF "▀" // Used by the scaled viewport to draw two rows of disks in one line
+#define LOWER_HALF "▄"
+
+#define SPACE_BETWEEN_POLES 3 // The number of empty spaces between poles when rendering
+#define DEFAULT_TERMINAL_ROWS 24 // Used by the viewport when the terminal size is not known
+#define DEFAULT_TERMINAL_COLUMNS 80
+// When animating at a target frame rate, the clock is checked every this many moves
+#define FRAME_CHECK_INTERVAL 16
+#define MS_TO_NS_MULTIPLIER 1000000 // 1 millisecond = 1,000,000 nanoseconds
+#define S_TO_MS_MULTIPLIER 1000 // 1 seconds = 1,000 milliseconds
+
+// Used by move logs
+#define MOVE_LOG_MAGIC "HANOIMV2" // The first 8 bytes of a binary move log
+#define MOVE_LOG_HEADER_SIZE 48
+// The first version of the format, which only had 64 bit move counts
+#define MOVE_LOG_MAGIC_V1 "HANOIMV1"
+#define MOVE_LOG_HEADER_SIZE_V1 32
+#define MOVE_LOG_BUFFER_SIZE (1 << 20) // Moves are written in blocks of about this many bytes
+
+#define MOVE_QUEUE_CAPACITY (1 << 16) // Moves the solver can get ahead of the render thread, a power of two
+#define CACHE_LINE_SIZE 64
+
+// Used by check_moves
+#define CHECK_CHUNK_BLOCKS 64 // Blocks of moves checked before their checksums are summed
+// Loops that only gain from wider vectors than the default x86-64 build can use
+// are also built for AVX2 and AVX-512, and the best one is picked at load time
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define CLONE_FOR_SIMD __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define CLONE_FOR_SIMD
+#endif
+
+// Used by checkpoints
+#define CHECKPOINT_MAGIC "HANOICP1" // The first 8 bytes of a checkpoint
+#define CHECKPOINT_HEADER_SIZE 40
+#define CHECKPOINT_CHECK_INTERVAL (1 << 20) // The clock is checked every this many moves
+
+// Used by the cast backend
+#define CAST_LINE_OVERHEAD 128 // Upper bound on the bytes of the header or of an event other than the frame
+#define JSON_ESCAPE_MAX_LENGTH 6 // The most bytes one byte takes in a JSON string, as in \u001b
+
+// Used to size the frame buffer
+#define MOVES_LINE_MAX_LENGTH 96 // Upper bound on the length of the "Moves:" line
+#define CURSOR_ESCAPE_MAX_LENGTH 14 // "\033[", the ten digits of an int, the command and a "\r"
+#define ERASE_LINE "\033[A\r\033[J" // Moves up one line and clears to the end of the screen
+#define COLOR_RESET "\033[0;0m"
+// Extra bytes needed to color a disk in the worst case
+#define COLOR_OVERHEAD (sizeof("\033[38;2;255;255;255m" COLOR_RESET) - 1)
+// Colors whose channels span less than this are matched to the 16 ANSI colors as grays
+#define ANSI_MIN_SATURATION 32
+
+// The levels of each channel of the 6x6x6 color cube in the xterm 256 color palette
+static const int CUBE_LEVELS[6] = {0, 95, 135, 175, 215, 255};
+// The default xterm values of the 16 ANSI colors
+static const struct Color ANSI_COLORS[16] = {
+    {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+    {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+    {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+};
+
+// Defines embedded_colors, generated from CET-I1.csv by the Makefile
+#include "colormap.h"
+
+/*
+ * Counters for finding where the time of a run goes, only kept when compiled
+ * with HANOI_STATS defined. Otherwise the STATS_ macros expand to nothing.
+ */
+#ifdef HANOI_STATS
+struct Stats {
+    unsigned long long moves;
+    unsigned long long frames; // The number of redraws
+    unsigned long long bytes; // Bytes of frames written to the terminal
+    unsigned long long escapes; // Escape sequences in those bytes
+    unsigned long long writes; // Calls to write out a frame
+    double render_seconds; // Time spent rendering frames into the frame buffer
+    double write_seconds; // Time spent writing frames out
+    double sleep_seconds; // Time spent sleeping between frames
+    // Time spent solving when it is measured on its own, or 0 if it is what is
+    // left of the total
+    double solve_seconds;
+    double first_frame_time; // When the first frame was written, or 0 if none has been
+};
+
+// Threads solving in parallel count into their own copy, which is not reported
+static _Thread_local struct Stats stats;
+
+#define STATS_ADD(counter, amount) (stats.counter += (amount))
+#define STATS_TIME_START(name) double name = get_time_seconds()
+#define STATS_TIME_END(counter, name) (stats.counter += get_time_seconds() - (name))
+#define STATS_TIME_FIRST(counter) (stats.counter = stats.counter == 0 ? get_time_seconds() : stats.counter)
+#else
+#define STATS_ADD(counter, amount) ((void) 0)
+#define STATS_TIME_START(name) ((void) 0)
+#define STATS_TIME_END(counter, name) ((void) 0)
+#define STATS_TIME_FIRST(counter) ((void) 0)
+#endif
+
+// A description of the last error on each thread, for get_error_message
+static _Thread_local char error_message[ERROR_MESSAGE_MAX_LENGTH];
+
+/*
+ * Records the message of an error, formatted like printf, and returns the error
+ */
+static enum HanoiError set_error(enum HanoiError error, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error_message, sizeof(error_message), format, args);
+    va_end(args);
+    return error;
+}
+
+/*
+ * Returns the message of the last error returned on this thread
+ */
+const char* get_error_message() {
+    return error_message;
+}
+
+/*
+ * Returns the time from a monotonic clock in seconds
+ */
+double get_time_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (double) now.tv_nsec / S_TO_NS_MULTIPLIER;
+}
+
+/*
+ * Rounds size up so that allocations after it are aligned for any type
+ */
+static size_t arena_round(size_t size) {
+    size_t alignment = _Alignof(max_align_t);
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/*
+ * Empties an arena and makes it able to hold size bytes of allocations, which
+ * must be measured with arena_round. The block it already has is reused if it
+ * is large enough.
+ */
+static enum HanoiError reserve_arena(struct Arena *arena, size_t size) {
+    arena->used = 0;
+    if (arena->data != NULL && arena->size >= size) {
+        return HANOI_OK;
+    }
+    free(arena->data);
+    arena->data = malloc(size > 0 ? size : 1);
+    if (arena->data == NULL) {
+        arena->size = 0;
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory allocating %zu bytes", size);
+    }
+    arena->size = size;
+    return HANOI_OK;
+}
+
+/*
+ * Returns size bytes from the arena, or NULL if it is full
+ */
+static void* arena_alloc(struct Arena *arena, size_t size) {
+    size = arena_round(size);
+    // Should not occur, since arenas are sized for what is allocated from them
+    if (size > arena->size - arena->used) {
+        return NULL;
+    }
+    void *ptr = arena->data + arena->used;
+    arena->used += size;
+    return ptr;
+}
+
+/*
+ * Frees everything allocated from the arena
+ */
+static void destroy_arena(struct Arena *arena) {
+    free(arena->data);
+    arena->data = NULL;
+}
+
+/*
+ * Maps a file into memory for reading
+ */
+enum HanoiError map_file(const char *filename, struct MappedFile *file) {
+#ifdef _WIN32
+    // Fall back to reading the whole file
+    FILE *stream = fopen(filename, "rb");
+    if (stream == NULL) {
+        return set_error(HANOI_ERROR_IO, "%s: %s", filename, strerror(errno));
+    }
+    fseek(stream, 0, SEEK_END);
+    long length = ftell(stream);
+    fseek(stream, 0, SEEK_SET);
+    if (length < 0) {
+        enum HanoiError error = set_error(HANOI_ERROR_IO, "%s: %s", filename, strerror(errno));
+        fclose(stream);
+        return error;
+    }
+    file->length = length;
+    file->data = malloc(length > 0 ? length : 1);
+    if (file->data == NULL) {
+        fclose(stream);
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory reading %s", filename);
+    }
+    if (fread(file->data, 1, file->length, stream) != file->length) {
+        enum HanoiError error = set_error(HANOI_ERROR_IO, "%s: %s", filename, strerror(errno));
+        free(file->data);
+        fclose(stream);
+        return error;
+    }
+    fclose(stream);
+    return HANOI_OK;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return set_error(HANOI_ERROR_IO, "%s: %s", filename, strerror(errno));
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        enum HanoiError error = set_error(HANOI_ERROR_IO, "%s: %s", filename, strerror(errno));
+        close(fd);
+        return error;
+    }
+    file->length = info.st_size;
+    if (file->length == 0) {
+        // Empty files cannot be mapped
+        file->data = NULL;
+        close(fd);
+        return HANOI_OK;
+    }
+    file->data = mmap(NULL, file->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->data == MAP_FAILED) {
+        return set_error(HANOI_ERROR_IO, "%s: %s", filename, strerror(errno));
+    }
+    // Files are read once from start to end
+    madvise(file->data, file->length, MADV_SEQUENTIAL);
+    return HANOI_OK;
+#endif
+}
+
+/*
+ * Unmaps a file mapped with map_file
+ */
+void unmap_file(struct MappedFile *file) {
+#ifdef _WIN32
+    free(file->data);
+#else
+    if (file->data != NULL) {
+        munmap(file->data, file->length);
+    }
+#endif
+}
+
+/*
+ * Skips spaces, tabs and line breaks
+ */
+static const char* skip_whitespace(const char *pos, const char *end) {
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n')) {
+        pos++;
+    }
+    return pos;
+}
+
+/*
+ * Scans a decimal integer with an optional sign, after any whitespace, from
+ * *pos and advances *pos past it. Large values are clamped to stay out of range
+ * without overflowing. Returns false if there is no integer.
+ */
+static bool scan_int(const char **pos, const char *end, int *value) {
+    const char *p = skip_whitespace(*pos, end);
+    bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    int result = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (result < INT_MAX / 10 - 10) {
+            result = result * 10 + (*p - '0');
+        }
+        p++;
+    }
+    *value = negative ? -result : result;
+    *pos = p;
+    return true;
+}
+
+/*
+ * Reads in a csv file containing the ColorMap. The file must contain three
+ * columns representing red, green and blue in that order. Each row defines a color
+ * as a triplet of numbers from 0-255 progressing from the lowest to highest
+ * color, and ends with "\n", "\r\n" or the end of the file. The colors are
+ * assumed to be equally spaced. There can be any number of colors included.
+ *
+ * Nothing needs to be destroyed on failure. A file with no colors is invalid.
+ */
+enum HanoiError load_colormap(const char *filename, struct ColorMap *colormap) {
+    struct MappedFile file;
+    enum HanoiError error = map_file(filename, &file);
+    if (error != HANOI_OK) {
+        return error;
+    }
+    const char *pos = (const char *) file.data;
+    const char *end = pos + file.length;
+
+    // Each record ends with a line break except possibly the last, which bounds
+    // the number of records
+    int max_records = 1;
+    for (const char *line = pos; (line = memchr(line, '\n', end - line)) != NULL; line++) {
+        max_records++;
+    }
+    struct Color *colors = malloc(max_records * sizeof(*colors));
+    if (colors == NULL) {
+        unmap_file(&file);
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory loading %s", filename);
+    }
+
+    int i = 0;
+    while ((pos = skip_whitespace(pos, end)) < end) {
+        int r, g, b;
+        bool valid = scan_int(&pos, end, &r) && pos < end && *pos++ == ',' &&
+                     scan_int(&pos, end, &g) && pos < end && *pos++ == ',' &&
+                     scan_int(&pos, end, &b);
+        if (!valid) {
+            free(colors);
+            unmap_file(&file);
+            return set_error(HANOI_ERROR_INVALID_FILE, "%s: record %d: colormap file format invalid", filename, i + 1);
+        }
+        // Each record must end its line, so that there are no more records than max_records
+        if (pos < end && *pos == '\r') {
+            pos++;
+        }
+        if ((pos < end && *pos != '\n') || i >= max_records) {
+            free(colors);
+            unmap_file(&file);
+            return set_error(HANOI_ERROR_INVALID_FILE, "%s: record %d: expected a line break after the record",
+                             filename, i + 1);
+        }
+        // Check validity
+        if (r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255) {
+            free(colors);
+            unmap_file(&file);
+            return set_error(HANOI_ERROR_INVALID_FILE, "%s: record %d: %d %d %d out of range", filename, i + 1, r, g, b);
+        }
+        colors[i].r = r;
+        colors[i].g = g;
+        colors[i].b = b;
+        i++;
+    }
+    unmap_file(&file);
+    if (i == 0) {
+        free(colors);
+        return set_error(HANOI_ERROR_INVALID_FILE, "colormap %s has no colors", filename);
+    }
+    colormap->colors = colors;
+    colormap->length = i;
+    return HANOI_OK;
+}
+
+/*
+ * Frees dynamically allocated memory
+ */
+void destroy_colormap(struct ColorMap colormap) {
+    free((struct Color *) colormap.colors);
+}
+
+/*
+ * Returns the colormap built into the executable, which must not be destroyed
+ */
+struct ColorMap embedded_colormap() {
+    struct ColorMap colormap;
+    colormap.colors = embedded_colors;
+    colormap.length = sizeof(embedded_colors) / sizeof(*embedded_colors);
+    return colormap;
+}
+
+/*
+ * Returns the squared distance between two colors
+ */
+static int color_distance(struct Color a, struct Color b) {
+    return (a.r - b.r) * (a.r - b.r) + (a.g - b.g) * (a.g - b.g) + (a.b - b.b) * (a.b - b.b);
+}
+
+/*
+ * Returns the index of the nearest level in CUBE_LEVELS to a channel value.
+ * The thresholds are the midpoints between levels.
+ */
+static int nearest_cube_level(int value) {
+    if (value < 48) {
+        return 0;
+    }
+    if (value < 115) {
+        return 1;
+    }
+    return (value - 35) / 40;
+}
+
+/*
+ * Returns the index of the nearest color in the xterm 256 color palette,
+ * choosing between the nearest color in the 6x6x6 cube and the nearest gray
+ */
+static int nearest_xterm_256(struct Color color) {
+    int r = nearest_cube_level(color.r);
+    int g = nearest_cube_level(color.g);
+    int b = nearest_cube_level(color.b);
+    struct Color cube = {CUBE_LEVELS[r], CUBE_LEVELS[g], CUBE_LEVELS[b]};
+
+    // The 24 grays from 232 have values 8 + 10 * i
+    int average = (color.r + color.g + color.b) / 3;
+    int gray_index = average < 8 ? 0 : (average - 8 + 5) / 10;
+    if (gray_index > 23) {
+        gray_index = 23;
+    }
+    int gray_value = 8 + 10 * gray_index;
+    struct Color gray = {gray_value, gray_value, gray_value};
+
+    if (color_distance(color, gray) < color_distance(color, cube)) {
+        return 232 + gray_index;
+    }
+    return 16 + 36 * r + 6 * g + b;
+}
+
+/*
+ * Returns the index of the nearest of the 16 ANSI colors. They are nearly all
+ * fully saturated, so unless the color is close to gray its channels are
+ * stretched to the full range first to match by hue. Otherwise pale colors
+ * would all become gray.
+ */
+static int nearest_ansi_16(struct Color color) {
+    int low = color.r < color.g ? (color.r < color.b ? color.r : color.b) : (color.g < color.b ? color.g : color.b);
+    int high = color.r > color.g ? (color.r > color.b ? color.r : color.b) : (color.g > color.b ? color.g : color.b);
+    if (high - low >= ANSI_MIN_SATURATION) {
+        color.r = (color.r - low) * 255 / (high - low);
+        color.g = (color.g - low) * 255 / (high - low);
+        color.b = (color.b - low) * 255 / (high - low);
+    }
+    int nearest = 0;
+    for (int i = 1; i < 16; i++) {
+        if (color_distance(color, ANSI_COLORS[i]) < color_distance(color, ANSI_COLORS[nearest])) {
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+/*
+ * Writes the escape sequence that sets the foreground or background color in
+ * the given mode to dest, which must hold at least COLOR_OVERHEAD bytes. Nothing
+ * is written for COLOR_NONE. Returns the length written.
+ */
+static int format_color(char *dest, size_t size, struct Color color, enum ColorMode mode, bool background) {
+    int base = background ? 40 : 30;
+    if (mode == COLOR_NONE) {
+        return snprintf(dest, size, "%s", "");
+    } else if (mode == COLOR_256) {
+        return snprintf(dest, size, "\033[%d;5;%dm", base + 8, nearest_xterm_256(color));
+    } else if (mode == COLOR_16) {
+        int index = nearest_ansi_16(color);
+        // The bright colors have their own codes
+        return snprintf(dest, size, "\033[%dm", index < 8 ? base + index : base + 60 + index - 8);
+    }
+    return snprintf(dest, size, "\033[%d;2;%d;%d;%dm", base + 8, color.r, color.g, color.b);
+}
+
+/*
+ * Writes count in decimal to dest. Counts that fit in 64 bits, which is all of
+ * them in practice, are formatted directly.
+ */
+void format_move_count(char *dest, size_t size, MoveCount count) {
+#if MOVE_COUNT_BITS > 64
+    if (count > ULLONG_MAX) {
+        // Split into 19 digit parts, which each fit in 64 bits
+        const unsigned long long base = 10000000000000000000ULL;
+        MoveCount upper = count / base;
+        unsigned long long lower = count % base;
+        if (upper > ULLONG_MAX) {
+            snprintf(dest, size, "%llu%019llu%019llu", (unsigned long long) (upper / base),
+                     (unsigned long long) (upper % base), lower);
+        } else {
+            snprintf(dest, size, "%llu%019llu", (unsigned long long) upper, lower);
+        }
+        return;
+    }
+#endif
+    snprintf(dest, size, "%llu", (unsigned long long) count);
+}
+
+/*
+ * Initializes an empty frame buffer that writes into the capacity bytes of
+ * data, which it does not free
+ */
+static void initialize_frame_buffer_with(struct FrameBuffer *buffer, char *data, size_t capacity) {
+    buffer->data = data;
+    buffer->length = 0;
+    buffer->capacity = capacity;
+    buffer->owns_data = false;
+    buffer->error = HANOI_OK;
+    buffer->file = stdout;
+    buffer->bytes_written = 0;
+    buffer->num_flushes = 0;
+}
+
+/*
+ * Allocates a frame buffer able to hold capacity bytes without growing
+ */
+static enum HanoiError initialize_frame_buffer(struct FrameBuffer *buffer, size_t capacity) {
+    // Nothing is allocated for an empty buffer, such as when running headless
+    buffer->data = capacity == 0 ? NULL : malloc(capacity);
+    if (capacity > 0 && buffer->data == NULL) {
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory allocating %zu bytes", capacity);
+    }
+    buffer->length = 0;
+    buffer->capacity = capacity;
+    buffer->owns_data = true;
+    buffer->error = HANOI_OK;
+    buffer->file = stdout;
+    buffer->bytes_written = 0;
+    buffer->num_flushes = 0;
+    return HANOI_OK;
+}
+
+/*
+ * Frees dynamically allocated memory
+ */
+static void destroy_frame_buffer(struct FrameBuffer *buffer) {
+    if (buffer->owns_data) {
+        free(buffer->data);
+    }
+}
+
+/*
+ * Ensures there is room for at least extra more bytes, growing the buffer if
+ * necessary. The buffer is sized for a full frame up front so this should only
+ * grow in unusual cases. Returns false and sets the buffer's error if it could
+ * not grow.
+ */
+static bool frame_buffer_reserve(struct FrameBuffer *buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity) {
+        return true;
+    }
+    size_t new_capacity = buffer->capacity * 2;
+    if (new_capacity < buffer->length + extra) {
+        new_capacity = buffer->length + extra;
+    }
+    char *data;
+    if (buffer->owns_data) {
+        data = realloc(buffer->data, new_capacity);
+    } else {
+        // The given memory cannot be grown, so move to memory of its own
+        data = malloc(new_capacity);
+        if (data != NULL) {
+            memcpy(data, buffer->data, buffer->length);
+        }
+    }
+    if (data == NULL) {
+        buffer->error = set_error(HANOI_ERROR_NO_MEMORY, "out of memory growing a buffer to %zu bytes", new_capacity);
+        return false;
+    }
+    buffer->data = data;
+    buffer->owns_data = true;
+    buffer->capacity = new_capacity;
+    return true;
+}
+
+/*
+ * Appends length bytes of str to the buffer
+ */
+static void buffer_append(struct FrameBuffer *buffer, const char *str, size_t length) {
+    if (!frame_buffer_reserve(buffer, length)) {
+        return;
+    }
+    memcpy(buffer->data + buffer->length, str, length);
+    buffer->length += length;
+}
+
+/*
+ * Appends a formatted string to the buffer
+ */
+static void buffer_printf(struct FrameBuffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    // Reserve an extra byte for the null terminator written by vsnprintf
+    if (!frame_buffer_reserve(buffer, length + 1)) {
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(buffer->data + buffer->length, length + 1, format, args);
+    va_end(args);
+    buffer->length += length;
+}
+
+/*
+ * Writes the contents of the buffer to its file with a single call and empties
+ * it. Sets the buffer's error if it could not be written.
+ */
+static void flush_frame_buffer(struct FrameBuffer *buffer) {
+    STATS_TIME_START(start);
+    bool written = fwrite(buffer->data, 1, buffer->length, buffer->file) == buffer->length;
+    if ((fflush(buffer->file) != 0 || !written) && buffer->error == HANOI_OK) {
+        buffer->error = set_error(HANOI_ERROR_IO, "failed to write frame: %s", strerror(errno));
+    }
+    STATS_TIME_END(write_seconds, start);
+    STATS_ADD(bytes, buffer->length);
+    STATS_ADD(writes, 1);
+    buffer->bytes_written += buffer->length;
+    buffer->num_flushes++;
+    buffer->length = 0;
+}
+
+/*
+ * Copies str to dest count times and returns the end of the copies
+ */
+static char* repeat_into(char *dest, const char *str, int count) {
+    size_t length = strlen(str);
+    for (int i = 0; i < count; i++) {
+        memcpy(dest, str, length);
+        dest += length;
+    }
+    return dest;
+}
+
+/*
+ * Appends a string n times
+ */
+static void buffer_repeat(struct FrameBuffer *buffer, const char str[], int count) {
+    if (!frame_buffer_reserve(buffer, strlen(str) * count)) {
+        return;
+    }
+    buffer->length = repeat_into(buffer->data + buffer->length, str, count) - buffer->data;
+}
+
+/*
+ * Appends the cursor escape "\033[<count><command>", followed by a carriage
+ * return if carriage_return is set. count must not be negative. The
+ * differential renderer writes several of these per move, so the digits are
+ * written directly instead of through buffer_printf.
+ */
+static void buffer_cursor_escape(struct FrameBuffer *buffer, int count, char command, bool carriage_return) {
+    if (!frame_buffer_reserve(buffer, CURSOR_ESCAPE_MAX_LENGTH)) {
+        return;
+    }
+    char *dest = buffer->data + buffer->length;
+    *dest++ = '\033';
+    *dest++ = '[';
+    char digits[10];
+    int num_digits = 0;
+    do {
+        digits[num_digits++] = '0' + count % 10;
+        count /= 10;
+    } while (count > 0);
+    while (num_digits > 0) {
+        *dest++ = digits[--num_digits];
+    }
+    *dest++ = command;
+    if (carriage_return) {
+        *dest++ = '\r';
+    }
+    buffer->length = dest - buffer->data;
+}
+
+/*
+ * Returns the number of bytes needed to render a full frame, including erasing
+ * the previous one. Every layer holds one disk or rod per pole, and each disk
+ * appears exactly once with a single color prefix and reset.
+ */
+static size_t frame_buffer_size(int num_layers, int num_poles) {
+    size_t layers = num_layers;
+    size_t cell_width = 2 * layers - 1;
+    size_t glyph_length = strlen(DISK) > strlen(ROD) ? strlen(DISK) : strlen(ROD);
+    size_t poles = num_poles;
+    size_t row_length = poles * cell_width * glyph_length + (poles - 1) * SPACE_BETWEEN_POLES + 1;
+    size_t erase_length = (layers + 1) * strlen(ERASE_LINE);
+    return erase_length + MOVES_LINE_MAX_LENGTH + layers * row_length + layers * COLOR_OVERHEAD;
+}
+
+/*
+ * Returns the prerendered span of a layer of a pole, which is that of its disk
+ * or the rod, and sets length to its length. layer is zero indexed
+ */
+static inline const char* layer_span(struct GameState game_state, struct Pole pole, int layer, size_t *length) {
+    if (pole.num_disk <= layer) {
+        *length = game_state.rod_span_length;
+        return game_state.rod_span;
+    }
+    struct Disk *disk = &game_state.disks[pole.disks[layer]];
+    // The color and the reset
+    STATS_ADD(escapes, game_state.color_mode != COLOR_NONE ? 2 : 0);
+    *length = disk->span_length;
+    return disk->span;
+}
+
+/*
+ * Renders a single layer of a pole. layer is zero indexed
+ */
+static void render_layer_pole(struct GameState game_state, struct Pole pole, int layer) {
+    size_t length;
+    const char *span = layer_span(game_state, pole, layer, &length);
+    buffer_append(game_state.frame_buffer, span, length);
+}
+
+/*
+ * Renders a single layer of num_poles poles as one copy of the span of each
+ * pole and the spaces between them, after reserving room for all of it at
+ * once. layer is zero indexed
+ */
+static inline void render_layer_poles(struct GameState game_state, int layer, int num_poles) {
+    const char *spans[MAX_NUM_POLES];
+    size_t lengths[MAX_NUM_POLES];
+    size_t length = (num_poles - 1) * SPACE_BETWEEN_POLES * strlen(EMPTY);
+    for (int i = 0; i < num_poles; i++) {
+        spans[i] = layer_span(game_state, game_state.poles[i], layer, &lengths[i]);
+        length += lengths[i];
+    }
+    struct FrameBuffer *buffer = game_state.frame_buffer;
+    if (!frame_buffer_reserve(buffer, length)) {
+        return;
+    }
+    char *dest = buffer->data + buffer->length;
+    for (int i = 0; i < num_poles; i++) {
+        memcpy(dest, spans[i], lengths[i]);
+        dest += lengths[i];
+        if (i != num_poles - 1) {
+            dest = repeat_into(dest, EMPTY, SPACE_BETWEEN_POLES);
+        }
+    }
+    buffer->length = dest - buffer->data;
+}
+
+/*
+ * Renders a single layer of poles. layer is zero indexed
+ */
+static void render_layer(struct GameState game_state, int layer) {
+    if (game_state.num_poles == DEFAULT_NUM_POLES) {
+        // Inlined with a constant number of poles, which unrolls the loops into
+        // a fixed sequence of copies for the usual case
+        render_layer_poles(game_state, layer, DEFAULT_NUM_POLES);
+    } else {
+        render_layer_poles(game_state, layer, game_state.num_poles);
+    }
+}
+
+/*
+ * Clears the previosly drawn image
+ */
+static void erase_drawing(struct GameState game_state) {
+    buffer_repeat(game_state.frame_buffer, ERASE_LINE, game_state.viewport.rows + 1);
+    STATS_ADD(escapes, 2 * (game_state.viewport.rows + 1));
+}
+
+/*
+ * Marks a layer of a pole as changed so that the next differential redraw
+ * rewrites it
+ */
+static void mark_dirty(struct Pole *pole, int layer) {
+    if (layer < pole->dirty_low) {
+        pole->dirty_low = layer;
+    }
+    if (layer > pole->dirty_high) {
+        pole->dirty_high = layer;
+    }
+}
+
+/*
+ * Marks every pole as unchanged
+ */
+static void clear_dirty(struct GameState game_state) {
+    for (int i = 0; i < game_state.num_poles; i++) {
+        game_state.poles[i].dirty_low = game_state.num_layers;
+        game_state.poles[i].dirty_high = -1;
+    }
+}
+
+/*
+ * Appends the "Moves:" line without a trailing newline
+ */
+static void render_moves(struct GameState game_state) {
+    char moves[MOVE_COUNT_MAX_DIGITS + 1];
+    format_move_count(moves, sizeof(moves), game_state.num_moves);
+    if (game_state.total_moves != MOVE_COUNT_MAX) {
+        char total[MOVE_COUNT_MAX_DIGITS + 1];
+        format_move_count(total, sizeof(total), game_state.total_moves);
+        // Redrawn every move, so appended directly instead of printed
+        buffer_append(game_state.frame_buffer, "Moves: ", strlen("Moves: "));
+        buffer_append(game_state.frame_buffer, moves, strlen(moves));
+        buffer_append(game_state.frame_buffer, " / ", strlen(" / "));
+        buffer_append(game_state.frame_buffer, total, strlen(total));
+    } else if (game_state.num_poles == DEFAULT_NUM_POLES) {
+        buffer_printf(game_state.frame_buffer, "Moves: %s / 2^%d - 1", moves, game_state.num_layers);
+    } else {
+        buffer_printf(game_state.frame_buffer, "Moves: %s / over 2^%d", moves, MOVE_COUNT_BITS);
+    }
+}
+
+/*
+ * Sleep to show the frame
+ */
+static void sleep_frame(int delay_ms) {
+    if (delay_ms == 0) {
+        return;
+    }
+    STATS_TIME_START(start);
+    struct timespec tv;
+    tv.tv_sec = delay_ms / S_TO_MS_MULTIPLIER;
+    tv.tv_nsec = (delay_ms % S_TO_MS_MULTIPLIER) * MS_TO_NS_MULTIPLIER;
+    nanosleep(&tv, NULL);
+    STATS_TIME_END(sleep_seconds, start);
+}
+
+/*
+ * Records frames as an asciinema v2 cast: a header line followed by one
+ * [time, "o", data] line per frame, where data is the frame as written to the
+ * terminal. The time of a frame is when it was drawn plus every delay before
+ * it, so that the cast plays back at the speed of the animation without the
+ * delays being slept while recording.
+ */
+struct CastWriter {
+    struct FrameBuffer line; // The line being written, sized for an escaped full frame
+    int width, height; // The size of the terminal the cast is played in
+    double start_time; // When the first frame was recorded
+    double delay_seconds; // The total of the delays recorded so far
+    unsigned long long num_frames;
+};
+
+/*
+ * Appends length bytes of data to the buffer as the contents of a JSON string.
+ * Quotes, backslashes and control characters, which include the escape that
+ * starts each escape sequence, are escaped and every other byte is copied.
+ */
+static void buffer_append_json(struct FrameBuffer *buffer, const char *data, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    if (!frame_buffer_reserve(buffer, length * JSON_ESCAPE_MAX_LENGTH)) {
+        return;
+    }
+    char *dest = buffer->data + buffer->length;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = data[i];
+        if (c == '"' || c == '\\') {
+            *dest++ = '\\';
+            *dest++ = c;
+        } else if (c == '\n' || c == '\r') {
+            *dest++ = '\\';
+            *dest++ = c == '\n' ? 'n' : 'r';
+        } else if (c < 0x20) {
+            memcpy(dest, "\\u00", 4);
+            dest[4] = hex[c >> 4];
+            dest[5] = hex[c & 0xf];
+            dest += 6;
+        } else {
+            *dest++ = c;
+        }
+    }
+    buffer->length = dest - buffer->data;
+}
+
+/*
+ * Writes the frame in frame as the next line of the cast, starting with the
+ * header for the first frame, and empties it. The delay after the frame is
+ * added to the times of the ones after it. Errors are set on frame.
+ */
+static void record_cast_frame(struct CastWriter *cast, struct FrameBuffer *frame, int delay_ms) {
+    struct FrameBuffer *line = &cast->line;
+    double now = get_time_seconds();
+    if (cast->num_frames == 0) {
+        cast->start_time = now;
+        buffer_printf(line, "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld}\n", cast->width,
+                      cast->height, (long long) time(NULL));
+    }
+    buffer_printf(line, "[%.6f, \"o\", \"", now - cast->start_time + cast->delay_seconds);
+    buffer_append_json(line, frame->data, frame->length);
+    buffer_append(line, "\"]\n", 3);
+    size_t length = line->length;
+    line->file = frame->file;
+    flush_frame_buffer(line);
+    if (line->error != HANOI_OK && frame->error == HANOI_OK) {
+        frame->error = line->error;
+    }
+    cast->delay_seconds += (double) delay_ms / S_TO_MS_MULTIPLIER;
+    cast->num_frames++;
+    frame->bytes_written += length;
+    frame->num_flushes++;
+    frame->length = 0;
+}
+
+/*
+ * Hands the frame in the frame buffer to the backend and empties the buffer.
+ * Only the terminal and text backends are watched as they are written, so
+ * only they sleep for the delay.
+ */
+static void present_frame(struct GameState game_state) {
+    struct FrameBuffer *buffer = game_state.frame_buffer;
+    switch (game_state.backend) {
+    case BACKEND_NULL:
+        STATS_ADD(bytes, buffer->length);
+        buffer->bytes_written += buffer->length;
+        buffer->num_flushes++;
+        buffer->length = 0;
+        break;
+    case BACKEND_CAST:
+        record_cast_frame(game_state.cast, buffer, game_state.delay_ms);
+        break;
+    case BACKEND_TERMINAL:
+    case BACKEND_TEXT:
+        flush_frame_buffer(buffer);
+        sleep_frame(game_state.delay_ms);
+        break;
+    }
+}
+
+/*
+ * Returns the number of columns a disk of the given size takes up in the
+ * viewport. It is odd so that the disk stays centered on the pole.
+ */
+static int viewport_disk_width(struct GameState game_state, int size) {
+    long long full_width = 2LL * game_state.num_layers - 1;
+    long long width = (2LL * size - 1) * game_state.viewport.pole_width / full_width;
+    if (width % 2 == 0) {
+        width--;
+    }
+    return width < 1 ? 1 : width;
+}
+
+/*
+ * Returns the disk at a layer of a pole, or -1 if there is none
+ */
+static int disk_at_layer(struct Pole pole, long long layer) {
+    return layer >= 0 && layer < pole.num_disk ? pole.disks[layer] : -1;
+}
+
+/*
+ * Renders one line of a pole in the viewport, with the top half of each cell
+ * showing the disk top and the bottom half showing the disk bottom. Either may
+ * be -1 for no disk, and they are the same disk when a line is one layer.
+ */
+static void render_viewport_pole(struct GameState game_state, int top, int bottom) {
+    struct FrameBuffer *buffer = game_state.frame_buffer;
+    int width = game_state.viewport.pole_width;
+    int center = width / 2;
+    int top_half_width = top == -1 ? -1 : viewport_disk_width(game_state, game_state.disks[top].size) / 2;
+    int bottom_half_width = bottom == -1 ? -1 : viewport_disk_width(game_state, game_state.disks[bottom].size) / 2;
+    // The colors currently set, -1 if none
+    int foreground = -1, background = -1;
+    for (int column = 0; column < width; column++) {
+        int distance = abs(column - center);
+        int cell_top = distance <= top_half_width ? top : -1;
+        int cell_bottom = distance <= bottom_half_width ? bottom : -1;
+        const char *glyph;
+        int cell_foreground = -1, cell_background = -1;
+        if (cell_top != -1 && cell_top == cell_bottom) {
+            glyph = DISK;
+            cell_foreground = cell_top;
+        } else if (cell_top != -1) {
+            glyph = UPPER_HALF;
+            cell_foreground = cell_top;
+            cell_background = cell_bottom;
+        } else if (cell_bottom != -1) {
+            glyph = LOWER_HALF;
+            cell_foreground = cell_bottom;
+        } else {
+            glyph = column == center ? ROD : EMPTY;
+        }
+
+        if (game_state.color_mode != COLOR_NONE &&
+                (cell_foreground != foreground || cell_background != background)) {
+            if (foreground != -1 || background != -1) {
+                buffer_append(buffer, COLOR_RESET, strlen(COLOR_RESET));
+                STATS_ADD(escapes, 1);
+            }
+            if (!frame_buffer_reserve(buffer, 2 * COLOR_OVERHEAD)) {
+                return;
+            }
+            if (cell_foreground != -1) {
+                buffer->length += format_color(buffer->data + buffer->length, 2 * COLOR_OVERHEAD,
+                                               game_state.disks[cell_foreground].color, game_state.color_mode, false);
+                STATS_ADD(escapes, 1);
+            }
+            if (cell_background != -1) {
+                buffer->length += format_color(buffer->data + buffer->length, COLOR_OVERHEAD,
+                                               game_state.disks[cell_background].color, game_state.color_mode, true);
+                STATS_ADD(escapes, 1);
+            }
+            foreground = cell_foreground;
+            background = cell_background;
+        }
+        buffer_append(buffer, glyph, strlen(glyph));
+    }
+    if (foreground != -1 || background != -1) {
+        buffer_append(buffer, COLOR_RESET, strlen(COLOR_RESET));
+        STATS_ADD(escapes, 1);
+    }
+}
+
+/*
+ * Renders one line of the viewport, with line 0 at the bottom. When scaled,
+ * each line shows two evenly spaced layers of the tower, using the lowest layer
+ * of the range each half stands for. Otherwise each pole shows its top layers
+ * and the empty layer above them.
+ */
+static void render_viewport_line(struct GameState game_state, int line) {
+    long long num_halves = 2LL * game_state.viewport.rows;
+    if (num_halves > game_state.num_layers) {
+        num_halves = game_state.num_layers;
+    }
+    for (int i = 0; i < game_state.num_poles; i++) {
+        struct Pole pole = game_state.poles[i];
+        int top, bottom;
+        if (game_state.viewport.mode == VIEWPORT_SCALE) {
+            long long top_half = 2LL * line + 1;
+            top = top_half < num_halves ? disk_at_layer(pole, top_half * game_state.num_layers / num_halves) : -1;
+            bottom = disk_at_layer(pole, 2LL * line * game_state.num_layers / num_halves);
+        } else {
+            long long lowest = pole.num_disk + 1 - game_state.viewport.rows;
+            top = bottom = disk_at_layer(pole, (lowest > 0 ? lowest : 0) + line);
+        }
+        render_viewport_pole(game_state, top, bottom);
+        if (i != game_state.num_poles - 1) {
+            buffer_repeat(game_state.frame_buffer, EMPTY, SPACE_BETWEEN_POLES);
+        }
+    }
+}
+
+/*
+ * Draws the number of steps and poles. The whole frame, along with anything
+ * already in the frame buffer, is handed to the backend in one piece, which the
+ * terminal and text backends write out with a single call.
+ */
+void draw(struct GameState game_state) {
+    STATS_TIME_START(start);
+    struct FrameBuffer *buffer = game_state.frame_buffer;
+    render_moves(game_state);
+    buffer_append(buffer, "\n", 1);
+    for (int i = game_state.viewport.rows - 1; i >= 0; i--) {
+        if (game_state.viewport.mode == VIEWPORT_NONE) {
+            render_layer(game_state, i);
+        } else {
+            render_viewport_line(game_state, i);
+        }
+        buffer_append(buffer, "\n", 1);
+    }
+    clear_dirty(game_state);
+    STATS_TIME_END(render_seconds, start);
+    present_frame(game_state);
+    // The first frame is always drawn in full
+    STATS_TIME_FIRST(first_frame_time);
+}
+
+/*
+ * Updates the previous drawing in place by rewriting only the layers of each
+ * pole that changed since it was drawn and the "Moves:" line. The cursor is
+ * assumed to be at the start of the line below the drawing, where it is left
+ * afterwards.
+ */
+static void draw_dirty(struct GameState game_state) {
+    STATS_TIME_START(start);
+    struct FrameBuffer *buffer = game_state.frame_buffer;
+    int pole_width = 2 * game_state.num_layers - 1;
+    for (int i = 0; i < game_state.num_poles; i++) {
+        struct Pole pole = game_state.poles[i];
+        // Columns are one indexed
+        int column = i * (pole_width + SPACE_BETWEEN_POLES) + 1;
+        for (int layer = pole.dirty_low; layer <= pole.dirty_high; layer++) {
+            // Layer zero is on the line directly above the cursor
+            buffer_cursor_escape(buffer, layer + 1, 'A', false);
+            buffer_cursor_escape(buffer, column, 'G', false);
+            render_layer_pole(game_state, pole, layer);
+            buffer_cursor_escape(buffer, layer + 1, 'B', true);
+            STATS_ADD(escapes, 3);
+        }
+    }
+    int moves_line = game_state.num_layers + 1;
+    buffer_cursor_escape(buffer, moves_line, 'A', true);
+    render_moves(game_state);
+    buffer_cursor_escape(buffer, moves_line, 'B', true);
+    STATS_ADD(escapes, 2);
+    clear_dirty(game_state);
+    STATS_TIME_END(render_seconds, start);
+    present_frame(game_state);
+}
+
+/*
+ * Replaces the previous drawing
+ */
+void redraw(struct GameState game_state) {
+    if (game_state.headless) {
+        return;
+    }
+    STATS_ADD(frames, 1);
+    if (game_state.backend == BACKEND_TEXT) {
+        // Text cannot go back over the last frame, so each one follows it after a blank line
+        buffer_append(game_state.frame_buffer, "\n", 1);
+        draw(game_state);
+    } else if (game_state.differential && game_state.viewport.mode == VIEWPORT_NONE) {
+        draw_dirty(game_state);
+    } else {
+        // A viewport is small enough to always redraw in full
+        erase_drawing(game_state);
+        draw(game_state);
+    }
+}
+
+/*
+ * Makes game_state draw at most fps frames a second instead of after every move,
+ * with the first frame due now. The delay is not used.
+ */
+void set_frame_rate(struct GameState *game_state, int fps) {
+    game_state->fps = fps;
+    game_state->delay_ms = 0;
+    game_state->next_frame = get_time_seconds();
+}
+
+/*
+ * Returns whether a frame should be drawn for the move just made. With a target
+ * frame rate, the clock is only read every FRAME_CHECK_INTERVAL moves, and the
+ * deadlines are kept on a fixed schedule unless a whole frame has been missed.
+ */
+static bool is_frame_due(struct GameState *game_state) {
+    if (game_state->skip_frames) {
+        return false;
+    }
+    if (game_state->fps == 0) {
+        return true;
+    }
+    if (game_state->num_moves % FRAME_CHECK_INTERVAL != 0) {
+        return false;
+    }
+    double now = get_time_seconds();
+    if (now < game_state->next_frame) {
+        return false;
+    }
+    double period = 1.0 / game_state->fps;
+    game_state->next_frame += period;
+    if (game_state->next_frame < now) {
+        // Fell behind, so start over instead of drawing frames to catch up
+        game_state->next_frame = now + period;
+    }
+    return true;
+}
+
+/*
+ * Draws the moves skipped since the last frame when animating at a target
+ * frame rate, so that the final state is shown
+ */
+void finish_animation(struct GameState game_state) {
+    if (game_state.fps > 0) {
+        redraw(game_state);
+    }
+}
+
+/*
+ * Returns the most bytes the span of a disk of the given size can take in a
+ * tower of num_layers layers
+ */
+static size_t disk_span_size(int num_layers, int size) {
+    return 2 * (size_t) (num_layers - size) * strlen(EMPTY) + COLOR_OVERHEAD + (2 * (size_t) size - 1) * strlen(DISK);
+}
+
+/*
+ * Returns the bytes of the span of a pole layer without a disk in a tower of
+ * num_layers layers
+ */
+static size_t rod_span_size(int num_layers) {
+    return 2 * (size_t) (num_layers - 1) * strlen(EMPTY) + strlen(ROD);
+}
+
+/*
+ * Renders the layer of a pole a disk is on once, the colored run of blocks with
+ * the padding on either side, so that drawing it is a single copy. It is
+ * allocated from arena. The color is quantized here for modes other than
+ * truecolor, and left out along with the reset for COLOR_NONE. Returns false if
+ * the arena is full.
+ */
+static bool initialize_disk_span(struct Disk *disk, int num_layers, enum ColorMode mode, struct Arena *arena) {
+    int buf_size = 64;
+    char prefix[buf_size];
+    int prefix_length = format_color(prefix, buf_size, disk->color, mode, false);
+    int padding = num_layers - disk->size;
+    int num_blocks = disk->size * 2 - 1;
+    int reset_length = mode == COLOR_NONE ? 0 : strlen(COLOR_RESET);
+
+    disk->span_length = 2 * padding * strlen(EMPTY) + prefix_length + num_blocks * strlen(DISK) + reset_length;
+    disk->span = arena_alloc(arena, disk->span_length);
+    if (disk->span == NULL) {
+        return false;
+    }
+    char *cursor = repeat_into(disk->span, EMPTY, padding);
+    memcpy(cursor, prefix, prefix_length);
+    cursor = repeat_into(cursor + prefix_length, DISK, num_blocks);
+    memcpy(cursor, COLOR_RESET, reset_length);
+    repeat_into(cursor + reset_length, EMPTY, padding);
+    return true;
+}
+
+/*
+ * Renders the layer of a pole with no disk on it, the rod with the padding on
+ * either side, allocating it from arena. Returns NULL if the arena is full.
+ */
+static char* create_rod_span(int num_layers, struct Arena *arena) {
+    char *span = arena_alloc(arena, rod_span_size(num_layers));
+    if (span == NULL) {
+        return NULL;
+    }
+    char *cursor = repeat_into(span, EMPTY, num_layers - 1);
+    memcpy(cursor, ROD, strlen(ROD));
+    repeat_into(cursor + strlen(ROD), EMPTY, num_layers - 1);
+    return span;
+}
+
+/*
+ * Returns the bytes of arena that create_disks and create_rod_span allocate
+ */
+static size_t disks_arena_size(int num_layers, bool spans) {
+    size_t size = arena_round(num_layers * sizeof(struct Disk));
+    if (spans) {
+        for (int i = 1; i <= num_layers; i++) {
+            size += arena_round(disk_span_size(num_layers, i));
+        }
+        size += arena_round(rod_span_size(num_layers));
+    }
+    return size;
+}
+
+/*
+ * Allocates and initializes the colors and spans of num_layers disks from the
+ * colormap, with larger disks taking colors from earlier in the colormap, to be
+ * written with the given color mode. The spans are only rendered if spans is set.
+ * Everything is allocated from arena. Returns NULL if the arena is full.
+ */
+static struct Disk* create_disks(int num_layers, struct ColorMap colormap, enum ColorMode mode, bool spans,
+                                 struct Arena *arena) {
+    // The minus one is because we use zero indexing when going through the map
+    // Special case to avoid dividing by zero
+    int colormap_increment;
+    if (num_layers == 1) {
+        colormap_increment = 0;
+    } else{
+        colormap_increment = colormap.length / (num_layers - 1);
+    }
+    if (colormap_increment < 1) {
+        colormap_increment = 1;
+    }
+    struct Disk *disks = arena_alloc(arena, num_layers * sizeof(*disks));
+    if (disks == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < num_layers; i++) {
+        // i counts from the bottom of the tower
+        struct Disk *disk = &disks[num_layers - 1 - i];
+        disk->size = num_layers - i;
+        int colormap_index = colormap_increment * i;
+        if (colormap_index >= colormap.length) {
+            colormap_index = colormap.length - 1;
+        }
+        disk->color = colormap.colors[colormap_index];
+        if (spans) {
+            if (!initialize_disk_span(disk, num_layers, mode, arena)) {
+                return NULL;
+            }
+        } else {
+            disk->span = NULL;
+            disk->span_length = 0;
+        }
+    }
+    return disks;
+}
+
+/*
+ * Returns the bytes of arena that create_poles allocates
+ */
+static size_t poles_arena_size(int num_poles, int num_layers) {
+    return arena_round(num_poles * sizeof(struct Pole)) + arena_round((size_t) num_poles * num_layers * sizeof(int));
+}
+
+/*
+ * Allocates an array of num_poles poles from arena, with the first being full
+ * and the rest empty. Returns NULL if the arena is full.
+ */
+static struct Pole* create_poles(int num_poles, int num_layers, struct Arena *arena) {
+    struct Pole *poles = arena_alloc(arena, num_poles * sizeof(*poles));
+    // The disks of every pole share one block
+    int *disks = arena_alloc(arena, (size_t) num_poles * num_layers * sizeof(*disks));
+    if (poles == NULL || disks == NULL) {
+        return NULL;
+    }
+    // Initialize all poles as empty
+    for (int i = 0; i < num_poles; i++) {
+        poles[i].num_disk = 0;
+        poles[i].dirty_low = num_layers;
+        poles[i].dirty_high = -1;
+        poles[i].disks = &disks[(size_t) i * num_layers];
+    }
+    // Fill first pole
+    poles[0].num_disk = num_layers;
+    for (int i = 0; i < num_layers; i++) {
+        poles[0].disks[i] = num_layers - 1 - i;
+    }
+    return poles;
+}
+
+/*
+ * Returns a pointer to the mask of a pole
+ */
+static uint64_t* pole_mask(struct GameState *game_state, int pole) {
+    return &game_state->masks[pole * game_state->num_words];
+}
+
+/*
+ * Returns whether the given disk is on the pole with the given mask
+ */
+static bool has_disk(const uint64_t mask[], int disk) {
+    return (mask[disk / 64] >> (disk % 64)) & 1;
+}
+
+/*
+ * Returns the index of the top disk of the pole with the given mask, or -1 if
+ * the pole is empty
+ */
+static int top_disk(const uint64_t mask[], int num_words) {
+    for (int i = 0; i < num_words; i++) {
+        if (mask[i] != 0) {
+            return i * 64 + __builtin_ctzll(mask[i]);
+        }
+    }
+    return -1;
+}
+
+/*
+ * Rebuilds the poles used for rendering from the masks, top to bottom
+ */
+static void sync_poles(struct GameState game_state) {
+    for (int i = 0; i < game_state.num_poles; i++) {
+        struct Pole *pole = &game_state.poles[i];
+        uint64_t *mask = pole_mask(&game_state, i);
+        pole->num_disk = 0;
+        for (int disk = game_state.num_layers - 1; disk >= 0; disk--) {
+            if (has_disk(mask, disk)) {
+                pole->disks[pole->num_disk] = disk;
+                pole->num_disk++;
+            }
+        }
+    }
+    clear_dirty(game_state);
+}
+
+/*
+ * Returns index of pole that is not pole1 or pole2. There always is one, since
+ * a game state has at least 3 poles.
+ */
+static int get_spare(int num_poles, int pole1, int pole2) {
+    for (int i = 0; i < num_poles; i++) {
+        if (i != pole1 && i != pole2) {
+            return i;
+        }
+    }
+    // Should not occur
+    return -1;
+}
+
+/*
+ * Initializes a game state with every disk on the first pole and no moves made.
+ * The total number of moves is set to that of the three pole solution.
+ * Nothing is set up for rendering, but it will render differentially with the
+ * default delay once it is. Nothing needs to be destroyed on failure.
+ */
+enum HanoiError initialize_game_state(struct GameState *game_state, int num_layers, int num_poles) {
+    game_state->masks = NULL;
+    game_state->masks_capacity = 0;
+    game_state->arena.data = NULL;
+    game_state->arena.size = 0;
+    game_state->arena.used = 0;
+    enum HanoiError error = reset_game_state(game_state, num_layers, num_poles);
+    if (error != HANOI_OK) {
+        destroy_game_state(game_state);
+    }
+    return error;
+}
+
+/*
+ * Sets up game_state for a new solve as initialize_game_state does, reusing the
+ * memory of the last one where it is large enough. Rendering must have been
+ * destroyed first.
+ */
+enum HanoiError reset_game_state(struct GameState *game_state, int num_layers, int num_poles) {
+    if (num_layers < 1) {
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT, "num_layers must be greater than zero");
+    }
+    if (num_poles < 3 || num_poles > MAX_NUM_POLES) {
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT, "poles must be between 3 and %d", MAX_NUM_POLES);
+    }
+    game_state->num_words = (num_layers + 63) / 64;
+    size_t num_masks = (size_t) num_poles * game_state->num_words;
+    if (num_masks > game_state->masks_capacity) {
+        free(game_state->masks);
+        game_state->masks_capacity = 0;
+        game_state->masks = malloc(num_masks * sizeof(*game_state->masks));
+        if (game_state->masks == NULL) {
+            return set_error(HANOI_ERROR_NO_MEMORY, "out of memory for %d layers", num_layers);
+        }
+        game_state->masks_capacity = num_masks;
+    }
+    memset(game_state->masks, 0, num_masks * sizeof(*game_state->masks));
+    for (int i = 0; i < num_layers; i++) {
+        game_state->masks[i / 64] |= 1ULL << (i % 64);
+    }
+    game_state->poles = NULL;
+    game_state->disks = NULL;
+    game_state->rod_span = NULL;
+    game_state->rod_span_length = 0;
+    game_state->frame_buffer = NULL;
+    game_state->backend = BACKEND_TERMINAL;
+    game_state->cast = NULL;
+    game_state->differential = true;
+    game_state->color_mode = COLOR_TRUECOLOR;
+    game_state->viewport.mode = VIEWPORT_NONE;
+    game_state->viewport.rows = num_layers;
+    game_state->viewport.pole_width = 2 * num_layers - 1;
+    game_state->headless = false;
+    game_state->delay_ms = ANIMATION_DELAY_MS;
+    game_state->fps = 0;
+    game_state->next_frame = 0;
+    game_state->skip_frames = false;
+    game_state->num_layers = num_layers;
+    game_state->num_poles = num_poles;
+    game_state->total_moves = num_layers >= MOVE_COUNT_BITS ? MOVE_COUNT_MAX : ((MoveCount) 1 << num_layers) - 1;
+    game_state->split_table = NULL;
+    game_state->goal = NULL;
+    game_state->move_log = NULL;
+    game_state->move_queue = NULL;
+    game_state->checkpointer = NULL;
+    game_state->move_sink = NULL;
+    game_state->move_sink_context = NULL;
+    game_state->error = HANOI_OK;
+    game_state->num_moves = 0;
+    game_state->checksum = 0;
+    return HANOI_OK;
+}
+
+/*
+ * Frees dynamically allocated memory, including the arena rendering was
+ * allocated from. Rendering must have been destroyed first.
+ */
+void destroy_game_state(struct GameState *game_state) {
+    free(game_state->masks);
+    destroy_arena(&game_state->arena);
+    game_state->masks = NULL;
+}
+
+/*
+ * Returns a hash of a move used to check that two solutions made the same moves
+ * in the same order. move is the one indexed move number.
+ */
+static unsigned long long move_checksum(unsigned long long move, int src, int dest) {
+    // The finalizer of splitmix64
+    unsigned long long x = move * (MAX_NUM_POLES * MAX_NUM_POLES) + src * MAX_NUM_POLES + dest;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * Returns the number of bits needed to store one move with the given number of
+ * poles. A move is one of num_poles * (num_poles - 1) pairs of poles.
+ */
+static int move_log_bits(int num_poles) {
+    int num_codes = num_poles * (num_poles - 1);
+    int bits = 1;
+    while ((1 << bits) < num_codes) {
+        bits++;
+    }
+    return bits;
+}
+
+/*
+ * Returns the code of a move in a binary move log. dest is never src, so it is
+ * shifted down to leave no gaps.
+ */
+static int encode_move(int num_poles, int src, int dest) {
+    return src * (num_poles - 1) + (dest > src ? dest - 1 : dest);
+}
+
+/*
+ * Stores the lowest num_bytes bytes of value in little endian order
+ */
+static void put_little_endian(unsigned char *dest, uint64_t value, int num_bytes) {
+    for (int i = 0; i < num_bytes; i++) {
+        dest[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+/*
+ * Returns the num_bytes byte little endian number stored at src
+ */
+static uint64_t get_little_endian(const unsigned char *src, int num_bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < num_bytes; i++) {
+        value |= (uint64_t) src[i] << (8 * i);
+    }
+    return value;
+}
+
+/*
+ * Stores a move count in 16 little endian bytes
+ */
+static void put_move_count(unsigned char *dest, MoveCount count) {
+    put_little_endian(dest, (uint64_t) count, 8);
+#if MOVE_COUNT_BITS > 64
+    put_little_endian(dest + 8, (uint64_t) (count >> 64), 8);
+#else
+    put_little_endian(dest + 8, 0, 8);
+#endif
+}
+
+/*
+ * Reverses encode_move. Returns false if code is not a valid move.
+ */
+static bool decode_move(int num_poles, int code, int *src, int *dest) {
+    if (code >= num_poles * (num_poles - 1)) {
+        return false;
+    }
+    *src = code / (num_poles - 1);
+    *dest = code % (num_poles - 1);
+    if (*dest >= *src) {
+        (*dest)++;
+    }
+    return true;
+}
+
+/*
+ * Returns the code of move number index (zero indexed) of packed moves made up
+ * of num_bytes bytes
+ */
+static int read_move_code(const unsigned char *moves, size_t num_bytes, unsigned long long index, int bits_per_move) {
+    unsigned long long bit = index * bits_per_move;
+    size_t byte = bit / 8;
+    // A code is at most 8 bits, so it spans at most two bytes
+    unsigned int pair = moves[byte];
+    if (byte + 1 < num_bytes) {
+        pair |= moves[byte + 1] << 8;
+    }
+    return (pair >> (bit % 8)) & ((1U << bits_per_move) - 1);
+}
+
+/*
+ * Parses and checks the header of a binary move log that is length bytes long,
+ * including that the log is long enough to hold all of its moves
+ */
+enum HanoiError read_move_log_header(const unsigned char *data, size_t length, struct MoveLogHeader *header) {
+    if (length >= MOVE_LOG_HEADER_SIZE && memcmp(data, MOVE_LOG_MAGIC, 8) == 0) {
+        header->header_size = MOVE_LOG_HEADER_SIZE;
+        header->start_move = get_little_endian(data + 16, 8);
+        header->num_moves = get_little_endian(data + 32, 8);
+        if (get_little_endian(data + 24, 8) != 0 || get_little_endian(data + 40, 8) != 0) {
+            return set_error(HANOI_ERROR_INVALID_FILE, "move log has too many moves to replay");
+        }
+    } else if (length >= MOVE_LOG_HEADER_SIZE_V1 && memcmp(data, MOVE_LOG_MAGIC_V1, 8) == 0) {
+        header->header_size = MOVE_LOG_HEADER_SIZE_V1;
+        header->start_move = get_little_endian(data + 16, 8);
+        header->num_moves = get_little_endian(data + 24, 8);
+    } else {
+        return set_error(HANOI_ERROR_INVALID_FILE, "not a binary move log");
+    }
+    uint64_t num_layers = get_little_endian(data + 8, 4);
+    header->num_poles = get_little_endian(data + 12, 2);
+    header->bits_per_move = get_little_endian(data + 14, 1);
+    if (num_layers == 0 || num_layers > INT_MAX) {
+        return set_error(HANOI_ERROR_INVALID_FILE, "move log has an invalid number of layers");
+    }
+    header->num_layers = num_layers;
+    if (header->num_poles < 3 || header->num_poles > MAX_NUM_POLES) {
+        return set_error(HANOI_ERROR_INVALID_FILE, "move log has an invalid number of poles");
+    }
+    if (header->bits_per_move != move_log_bits(header->num_poles)) {
+        return set_error(HANOI_ERROR_INVALID_FILE, "move log has %d bits per move instead of %d",
+                         header->bits_per_move, move_log_bits(header->num_poles));
+    }
+    // Check the length without overflowing
+    uint64_t max_moves = (length - header->header_size) * 8 / header->bits_per_move;
+    if (header->num_moves > max_moves) {
+        return set_error(HANOI_ERROR_INVALID_FILE, "move log is truncated, it holds at most %llu of %llu moves",
+                         (unsigned long long) max_moves, header->num_moves);
+    }
+    return HANOI_OK;
+}
+
+/*
+ * Writes out the buffered part of a move log, setting the log's error on
+ * failure
+ */
+static void flush_move_log(struct MoveLog *log) {
+    if (fwrite(log->buffer.data, 1, log->buffer.length, log->file) != log->buffer.length && log->error == HANOI_OK) {
+        log->error = set_error(HANOI_ERROR_IO, "failed to write move log: %s", strerror(errno));
+    }
+    log->buffer.length = 0;
+}
+
+/*
+ * Opens filename, or stdout if it is "-", as a move log for the moves that
+ * follow the current state of game_state
+ */
+enum HanoiError open_move_log(struct MoveLog *log, const char *filename, enum MoveLogFormat format,
+                              struct GameState game_state) {
+    if (strcmp(filename, "-") == 0) {
+        log->file = stdout;
+    } else {
+        log->file = fopen(filename, format == MOVE_LOG_BINARY ? "wb" : "w");
+        if (log->file == NULL) {
+            return set_error(HANOI_ERROR_IO, "failed to open move log: %s", strerror(errno));
+        }
+    }
+    log->format = format;
+    log->num_poles = game_state.num_poles;
+    log->bits_per_move = move_log_bits(game_state.num_poles);
+    log->bits = 0;
+    log->num_bits = 0;
+    log->error = initialize_frame_buffer(&log->buffer, MOVE_LOG_BUFFER_SIZE);
+    if (log->error != HANOI_OK) {
+        if (log->file != stdout) {
+            fclose(log->file);
+        }
+        return log->error;
+    }
+
+    if (format == MOVE_LOG_BINARY) {
+        unsigned char header[MOVE_LOG_HEADER_SIZE];
+        memcpy(header, MOVE_LOG_MAGIC, 8);
+        put_little_endian(header + 8, game_state.num_layers, 4);
+        put_little_endian(header + 12, game_state.num_poles, 2);
+        put_little_endian(header + 14, log->bits_per_move, 1);
+        put_little_endian(header + 15, 0, 1);
+        put_move_count(header + 16, game_state.num_moves);
+        put_move_count(header + 32, game_state.total_moves - game_state.num_moves);
+        buffer_append(&log->buffer, (char *) header, MOVE_LOG_HEADER_SIZE);
+    }
+    return HANOI_OK;
+}
+
+/*
+ * Appends a move to a move log
+ */
+static void log_move(struct MoveLog *log, int src, int dest) {
+    if (log->format == MOVE_LOG_TEXT) {
+        // Poles have at most two digits
+        char line[8];
+        int length = 0;
+        if (src >= 10) {
+            line[length++] = '0' + src / 10;
+        }
+        line[length++] = '0' + src % 10;
+        line[length++] = ' ';
+        if (dest >= 10) {
+            line[length++] = '0' + dest / 10;
+        }
+        line[length++] = '0' + dest % 10;
+        line[length++] = '\n';
+        buffer_append(&log->buffer, line, length);
+    } else {
+        uint64_t code = encode_move(log->num_poles, src, dest);
+        log->bits |= code << log->num_bits;
+        log->num_bits += log->bits_per_move;
+        if (log->num_bits >= 64) {
+            // The word is full, so write it out and keep the bits that did not fit
+            unsigned char word[8];
+            put_little_endian(word, log->bits, 8);
+            buffer_append(&log->buffer, (char *) word, 8);
+            log->num_bits -= 64;
+            log->bits = log->num_bits == 0 ? 0 : code >> (log->bits_per_move - log->num_bits);
+        }
+    }
+    if (log->buffer.length >= MOVE_LOG_BUFFER_SIZE) {
+        flush_move_log(log);
+    }
+}
+
+/*
+ * Writes out anything left in a move log and closes it. Returns the first error
+ * writing it.
+ */
+enum HanoiError close_move_log(struct MoveLog *log) {
+    if (log->num_bits > 0) {
+        unsigned char word[8];
+        put_little_endian(word, log->bits, 8);
+        buffer_append(&log->buffer, (char *) word, (log->num_bits + 7) / 8);
+    }
+    flush_move_log(log);
+    destroy_frame_buffer(&log->buffer);
+    if ((log->file == stdout ? fflush(stdout) != 0 : fclose(log->file) != 0) && log->error == HANOI_OK) {
+        log->error = set_error(HANOI_ERROR_IO, "failed to write move log: %s", strerror(errno));
+    }
+    return log->error;
+}
+
+/*
+ * Returns the size of the checkpoint of a game state
+ */
+static size_t checkpoint_size(struct GameState game_state) {
+    return CHECKPOINT_HEADER_SIZE + (size_t) game_state.num_poles * game_state.num_words * 8;
+}
+
+/*
+ * Writes the checkpoint of a game state to dest, which holds checkpoint_size bytes
+ */
+static void serialize_checkpoint(unsigned char *dest, struct GameState game_state) {
+    memcpy(dest, CHECKPOINT_MAGIC, 8);
+    put_little_endian(dest + 8, game_state.num_layers, 4);
+    put_little_endian(dest + 12, game_state.num_poles, 2);
+    put_little_endian(dest + 14, 0, 2);
+    put_move_count(dest + 16, game_state.num_moves);
+    put_little_endian(dest + 32, game_state.checksum, 8);
+    int num_masks = game_state.num_poles * game_state.num_words;
+    for (int i = 0; i < num_masks; i++) {
+        put_little_endian(dest + CHECKPOINT_HEADER_SIZE + 8 * i, game_state.masks[i], 8);
+    }
+}
+
+/*
+ * Reads a checkpoint from a file. Nothing needs to be destroyed on failure.
+ */
+enum HanoiError read_checkpoint(const char *filename, struct Checkpoint *checkpoint) {
+    struct MappedFile file;
+    enum HanoiError error = map_file(filename, &file);
+    if (error != HANOI_OK) {
+        return error;
+    }
+    if (file.length < CHECKPOINT_HEADER_SIZE || memcmp(file.data, CHECKPOINT_MAGIC, 8) != 0) {
+        unmap_file(&file);
+        return set_error(HANOI_ERROR_INVALID_FILE, "%s is not a checkpoint", filename);
+    }
+    uint64_t num_layers = get_little_endian(file.data + 8, 4);
+    checkpoint->num_poles = get_little_endian(file.data + 12, 2);
+    if (num_layers == 0 || num_layers > INT_MAX || checkpoint->num_poles < 3 || checkpoint->num_poles > MAX_NUM_POLES) {
+        unmap_file(&file);
+        return set_error(HANOI_ERROR_INVALID_FILE, "checkpoint has an invalid number of layers or poles");
+    }
+    checkpoint->num_layers = num_layers;
+    size_t num_masks = (size_t) checkpoint->num_poles * ((num_layers + 63) / 64);
+    if (file.length != CHECKPOINT_HEADER_SIZE + num_masks * 8) {
+        unmap_file(&file);
+        return set_error(HANOI_ERROR_INVALID_FILE, "checkpoint has the wrong size");
+    }
+    checkpoint->num_moves = get_little_endian(file.data + 16, 8);
+#if MOVE_COUNT_BITS > 64
+    checkpoint->num_moves |= (MoveCount) get_little_endian(file.data + 24, 8) << 64;
+#endif
+    checkpoint->checksum = get_little_endian(file.data + 32, 8);
+    checkpoint->masks = malloc(num_masks * sizeof(*checkpoint->masks));
+    if (checkpoint->masks == NULL) {
+        unmap_file(&file);
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory reading %s", filename);
+    }
+    for (size_t i = 0; i < num_masks; i++) {
+        checkpoint->masks[i] = get_little_endian(file.data + CHECKPOINT_HEADER_SIZE + 8 * i, 8);
+    }
+    unmap_file(&file);
+    return HANOI_OK;
+}
+
+/*
+ * Frees dynamically allocated memory
+ */
+void destroy_checkpoint(struct Checkpoint *checkpoint) {
+    free(checkpoint->masks);
+}
+
+/*
+ * Records that a checkpoint could not be written, keeping the first error.
+ * Called by the writer with the mutex unlocked.
+ */
+static void checkpoint_failed(struct Checkpointer *checkpointer, const char *message) {
+    int saved_errno = errno;
+    pthread_mutex_lock(&checkpointer->mutex);
+    if (checkpointer->error == HANOI_OK) {
+        checkpointer->error = HANOI_ERROR_IO;
+        snprintf(checkpointer->error_message, sizeof(checkpointer->error_message), "%s: %s",
+                 message, strerror(saved_errno));
+    }
+    pthread_mutex_unlock(&checkpointer->mutex);
+}
+
+/*
+ * Replaces the checkpoint file with data, recording an error if it could not
+ * be written
+ */
+static void write_checkpoint_file(struct Checkpointer *checkpointer, const unsigned char *data) {
+    FILE *file = fopen(checkpointer->temp_filename, "wb");
+    if (file == NULL) {
+        checkpoint_failed(checkpointer, "failed to write checkpoint");
+        return;
+    }
+    bool written = fwrite(data, 1, checkpointer->size, file) == checkpointer->size && fflush(file) == 0;
+#ifndef _WIN32
+    // Make sure the checkpoint survives the machine going away, not just the process
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    if (fclose(file) != 0 || !written) {
+        checkpoint_failed(checkpointer, "failed to write checkpoint");
+        remove(checkpointer->temp_filename);
+        return;
+    }
+#ifdef _WIN32
+    bool renamed = MoveFileExA(checkpointer->temp_filename, checkpointer->filename, MOVEFILE_REPLACE_EXISTING);
+#else
+    bool renamed = rename(checkpointer->temp_filename, checkpointer->filename) == 0;
+#endif
+    if (!renamed) {
+        checkpoint_failed(checkpointer, "failed to replace checkpoint");
+    }
+}
+
+/*
+ * Thread entry point for writing checkpoints. Writes each checkpoint handed
+ * over until it is stopped.
+ */
+static void* write_checkpoints(void *arg) {
+    struct Checkpointer *checkpointer = arg;
+    unsigned char *data = checkpointer->writing;
+    pthread_mutex_lock(&checkpointer->mutex);
+    while (true) {
+        while (!checkpointer->has_pending && !checkpointer->stopping) {
+            pthread_cond_wait(&checkpointer->ready, &checkpointer->mutex);
+        }
+        if (!checkpointer->has_pending) {
+            break;
+        }
+        memcpy(data, checkpointer->pending, checkpointer->size);
+        checkpointer->has_pending = false;
+        pthread_mutex_unlock(&checkpointer->mutex);
+        write_checkpoint_file(checkpointer, data);
+        pthread_mutex_lock(&checkpointer->mutex);
+    }
+    pthread_mutex_unlock(&checkpointer->mutex);
+    return NULL;
+}
+
+/*
+ * Frees dynamically allocated memory
+ */
+static void destroy_checkpointer(struct Checkpointer *checkpointer) {
+    free(checkpointer->temp_filename);
+    free(checkpointer->pending);
+    free(checkpointer->writing);
+}
+
+/*
+ * Starts writing checkpoints of game_state to filename every interval seconds
+ */
+enum HanoiError start_checkpointer(struct Checkpointer *checkpointer, const char *filename, int interval,
+                                   struct GameState *game_state) {
+    checkpointer->filename = filename;
+    checkpointer->interval = interval;
+    checkpointer->next_time = get_time_seconds() + interval;
+    checkpointer->size = checkpoint_size(*game_state);
+    checkpointer->temp_filename = malloc(strlen(filename) + sizeof(".tmp"));
+    checkpointer->pending = malloc(checkpointer->size);
+    checkpointer->writing = malloc(checkpointer->size);
+    if (checkpointer->temp_filename == NULL || checkpointer->pending == NULL || checkpointer->writing == NULL) {
+        destroy_checkpointer(checkpointer);
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory for checkpoints");
+    }
+    strcpy(checkpointer->temp_filename, filename);
+    strcat(checkpointer->temp_filename, ".tmp");
+    checkpointer->has_pending = false;
+    checkpointer->stopping = false;
+    checkpointer->error = HANOI_OK;
+    pthread_mutex_init(&checkpointer->mutex, NULL);
+    pthread_cond_init(&checkpointer->ready, NULL);
+    int error = pthread_create(&checkpointer->thread, NULL, write_checkpoints, checkpointer);
+    if (error != 0) {
+        pthread_mutex_destroy(&checkpointer->mutex);
+        pthread_cond_destroy(&checkpointer->ready);
+        destroy_checkpointer(checkpointer);
+        return set_error(HANOI_ERROR_THREAD, "failed to create thread: %s", strerror(error));
+    }
+    game_state->checkpointer = checkpointer;
+    return HANOI_OK;
+}
+
+/*
+ * Hands a checkpoint of game_state to the writer if one is due. Never waits for
+ * the writer.
+ */
+static void checkpoint_if_due(struct GameState *game_state) {
+    struct Checkpointer *checkpointer = game_state->checkpointer;
+    double now = get_time_seconds();
+    if (now < checkpointer->next_time || pthread_mutex_trylock(&checkpointer->mutex) != 0) {
+        return;
+    }
+    serialize_checkpoint(checkpointer->pending, *game_state);
+    checkpointer->has_pending = true;
+    pthread_cond_signal(&checkpointer->ready);
+    pthread_mutex_unlock(&checkpointer->mutex);
+    checkpointer->next_time = now + checkpointer->interval;
+}
+
+/*
+ * Writes a last checkpoint of game_state and waits for the writer to finish.
+ * Returns the first error writing a checkpoint.
+ */
+enum HanoiError stop_checkpointer(struct GameState *game_state) {
+    struct Checkpointer *checkpointer = game_state->checkpointer;
+    pthread_mutex_lock(&checkpointer->mutex);
+    serialize_checkpoint(checkpointer->pending, *game_state);
+    checkpointer->has_pending = true;
+    checkpointer->stopping = true;
+    pthread_cond_signal(&checkpointer->ready);
+    pthread_mutex_unlock(&checkpointer->mutex);
+    pthread_join(checkpointer->thread, NULL);
+
+    pthread_mutex_destroy(&checkpointer->mutex);
+    pthread_cond_destroy(&checkpointer->ready);
+    destroy_checkpointer(checkpointer);
+    game_state->checkpointer = NULL;
+    if (checkpointer->error != HANOI_OK) {
+        return set_error(checkpointer->error, "%s", checkpointer->error_message);
+    }
+    return HANOI_OK;
+}
+
+/*
+ * A single producer, single consumer ring of moves from the solver to the
+ * render thread. Each move is stored in a byte as src << 4 | dest. head and tail
+ * only ever increase and are reduced modulo the capacity when indexing. They
+ * are kept on separate cache lines so that the two threads do not contend.
+ */
+struct MoveQueue {
+    unsigned char *moves;
+    size_t capacity; // A power of two
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head; // The next move written, only stored by the solver
+    size_t cached_tail; // The last value of tail seen by the solver
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail; // The next move read, only stored by the render thread
+    atomic_bool closed; // Set by the solver after its last move
+};
+
+static enum HanoiError initialize_move_queue(struct MoveQueue *queue, size_t capacity) {
+    queue->moves = malloc(capacity);
+    if (queue->moves == NULL) {
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory for the move queue");
+    }
+    queue->capacity = capacity;
+    atomic_init(&queue->head, 0);
+    queue->cached_tail = 0;
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->closed, false);
+    return HANOI_OK;
+}
+
+static void destroy_move_queue(struct MoveQueue *queue) {
+    free(queue->moves);
+}
+
+/*
+ * Adds a move to the queue, waiting for the render thread to make room if it
+ * is full. Only called by the solver.
+ */
+static void push_move(struct MoveQueue *queue, int src, int dest) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    while (head - queue->cached_tail == queue->capacity) {
+        queue->cached_tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        if (head - queue->cached_tail == queue->capacity) {
+            sched_yield();
+        }
+    }
+    queue->moves[head & (queue->capacity - 1)] = (unsigned char) (src << 4 | dest);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+/*
+ * Tells the render thread that no more moves will be added
+ */
+static void close_move_queue(struct MoveQueue *queue) {
+    atomic_store_explicit(&queue->closed, true, memory_order_release);
+}
+
+/*
+ * Returns whether the top disk of src can be moved onto dest, which is false
+ * for poles that do not exist
+ */
+bool is_legal_move(struct GameState *game_state, int src, int dest) {
+    if (src < 0 || src >= game_state->num_poles || dest < 0 || dest >= game_state->num_poles) {
+        return false;
+    }
+    int disk = top_disk(pole_mask(game_state, src), game_state->num_words);
+    int dest_top = top_disk(pole_mask(game_state, dest), game_state->num_words);
+    return disk != -1 && (dest_top == -1 || disk < dest_top);
+}
+
+/*
+ * Moves the top disk of src to dest
+ *
+ * If the attempted move is invalid, or anything the move is sent to fails,
+ * game_state->error is set, which stops the solve.
+ */
+void move_disk(struct GameState *game_state, int src, int dest) {
+    if (src < 0 || src >= game_state->num_poles || dest < 0 || dest >= game_state->num_poles) {
+        game_state->error = set_error(HANOI_ERROR_INVALID_ARGUMENT, "attempted to move from pole %d to pole %d of %d",
+                                      src, dest, game_state->num_poles);
+        return;
+    }
+    if (src == dest) {
+        game_state->error = set_error(HANOI_ERROR_ILLEGAL_MOVE, "attempted to move from pole %d to itself", src);
+        return;
+    }
+    uint64_t *src_mask = pole_mask(game_state, src);
+    uint64_t *dest_mask = pole_mask(game_state, dest);
+    int disk = top_disk(src_mask, game_state->num_words);
+    // Ensure that the src pole is not empty and that there would not be a larger
+    // piece on a smaller piece for debugging.
+    // Should not occur
+    if (disk == -1) {
+        game_state->error = set_error(HANOI_ERROR_ILLEGAL_MOVE, "src pole (%d) is empty", src);
+        return;
+    }
+    int dest_top = top_disk(dest_mask, game_state->num_words);
+    if (dest_top != -1 && dest_top < disk) {
+        game_state->error = set_error(HANOI_ERROR_ILLEGAL_MOVE, "attempted to move disk %d from pole %d onto disk %d",
+                                      disk, src, dest_top);
+        return;
+    }
+
+    // Move the disk
+    uint64_t bit = 1ULL << (disk % 64);
+    src_mask[disk / 64] ^= bit;
+    dest_mask[disk / 64] |= bit;
+    game_state->num_moves++;
+    STATS_ADD(moves, 1);
+    game_state->checksum += move_checksum(game_state->num_moves, src, dest);
+    if (game_state->move_log != NULL) {
+        log_move(game_state->move_log, src, dest);
+        if (game_state->move_log->error != HANOI_OK) {
+            game_state->error = game_state->move_log->error;
+        }
+    }
+    if (game_state->move_sink != NULL && !game_state->move_sink(game_state->move_sink_context, src, dest)) {
+        game_state->error = set_error(HANOI_ERROR_STOPPED, "stopped by the move sink after move %llu",
+                                      (unsigned long long) game_state->num_moves);
+    }
+    if (game_state->move_queue != NULL) {
+        push_move(game_state->move_queue, src, dest);
+    }
+    if (game_state->checkpointer != NULL && game_state->num_moves % CHECKPOINT_CHECK_INTERVAL == 0) {
+        checkpoint_if_due(game_state);
+    }
+
+    if (!game_state->headless) {
+        struct Pole *src_pole = &game_state->poles[src];
+        struct Pole *dest_pole = &game_state->poles[dest];
+        dest_pole->disks[dest_pole->num_disk] = disk;
+        dest_pole->num_disk++;
+        src_pole->num_disk--;
+        // Only the old top of src and the new top of dest need to be redrawn
+        mark_dirty(src_pole, src_pole->num_disk);
+        mark_dirty(dest_pole, dest_pole->num_disk - 1);
+        if (is_frame_due(game_state)) {
+            redraw(*game_state);
+            if (game_state->frame_buffer->error != HANOI_OK) {
+                game_state->error = game_state->frame_buffer->error;
+            }
+        }
+    }
+}
+
+/*
+ * Move a stack of "size" disks from the src to dest pole. Renders each step.
+ */
+static void move_stack(struct GameState *game_state, int size, int src, int dest) {
+    if (game_state->error != HANOI_OK) {
+        return;
+    }
+    if (size == 1) {
+        move_disk(game_state, src, dest);
+    } else {
+        int spare = get_spare(game_state->num_poles, src, dest);
+        move_stack(game_state, size - 1, src, spare);
+        move_stack(game_state, 1, src, dest);
+        move_stack(game_state, size - 1, spare, dest);
+    }
+}
+
+/*
+ * Like move_stack, but assumes that the first skip moves have already been made.
+ * The moves are skipped by descending into the half of the recursion that
+ * contains the first move not yet made, so it takes O(size) before resuming.
+ */
+static void resume_stack(struct GameState *game_state, int size, int src, int dest, unsigned long long skip) {
+    if (size == 0) {
+        return;
+    }
+    if (skip == 0) {
+        move_stack(game_state, size, src, dest);
+        return;
+    }
+    int spare = get_spare(game_state->num_poles, src, dest);
+    // Moving the stack above the bottom disk takes half - 1 moves, then the bottom
+    // disk is moved on move number half
+    unsigned long long half = 1ULL << (size - 1);
+    if (skip < half) {
+        resume_stack(game_state, size - 1, src, spare, skip);
+        move_stack(game_state, 1, src, dest);
+        move_stack(game_state, size - 1, spare, dest);
+    } else {
+        resume_stack(game_state, size - 1, spare, dest, skip - half);
+    }
+}
+
+/*
+ * Replaces the state with the one reached after the given number of moves of
+ * the solution in O(num_layers). Disk i, counting from the smallest, has moved
+ * (move + 2^i) / 2^(i + 1) times, always cycling through the poles in the same
+ * direction. The direction alternates with i so that the bottom disk moves
+ * straight from the first pole to the last.
+ *
+ * Requires num_poles == 3, num_layers <= CLOSED_FORM_MAX_LAYERS and
+ * move <= 2^num_layers - 1.
+ */
+enum HanoiError set_state_at_move(struct GameState *game_state, unsigned long long move) {
+    int num_layers = game_state->num_layers;
+    if (game_state->num_poles != 3 || num_layers > CLOSED_FORM_MAX_LAYERS) {
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT, "seeking requires 3 poles and at most %d layers",
+                         CLOSED_FORM_MAX_LAYERS);
+    }
+    if (move > (1ULL << num_layers) - 1) {
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT, "move must be at most %llu", (1ULL << num_layers) - 1);
+    }
+    memset(game_state->masks, 0, game_state->num_poles * game_state->num_words * sizeof(*game_state->masks));
+    for (int i = 0; i < num_layers; i++) {
+        unsigned long long times_moved = (move >> i) / 2 + ((move >> i) & 1);
+        int direction = (num_layers - i) % 2 == 1 ? 2 : 1;
+        uint64_t *mask = pole_mask(game_state, (times_moved % 3) * direction % 3);
+        mask[i / 64] |= 1ULL << (i % 64);
+    }
+    game_state->num_moves = move;
+    // Seeking happens before rendering is set up
+    if (game_state->poles != NULL) {
+        sync_poles(*game_state);
+    }
+    return HANOI_OK;
+}
+
+/*
+ * Replaces the state with one where disk i, counting from the smallest, is on
+ * poles[i]. Any such placement is legal, since the disks on each pole are kept
+ * in order. The number of moves is reset to 0.
+ */
+enum HanoiError set_configuration(struct GameState *game_state, const int *poles) {
+    for (int i = 0; i < game_state->num_layers; i++) {
+        if (poles[i] < 0 || poles[i] >= game_state->num_poles) {
+            return set_error(HANOI_ERROR_INVALID_ARGUMENT, "disk %d is on pole %d of %d", i, poles[i],
+                             game_state->num_poles);
+        }
+    }
+    memset(game_state->masks, 0, game_state->num_poles * game_state->num_words * sizeof(*game_state->masks));
+    for (int i = 0; i < game_state->num_layers; i++) {
+        uint64_t *mask = pole_mask(game_state, poles[i]);
+        mask[i / 64] |= 1ULL << (i % 64);
+    }
+    game_state->num_moves = 0;
+    if (game_state->poles != NULL) {
+        sync_poles(*game_state);
+    }
+    return HANOI_OK;
+}
+
+/*
+ * Checks packed moves from a binary move log one at a time, starting from move
+ * number first. See check_moves.
+ */
+static unsigned long long check_moves_scalar(struct GameState *game_state, const unsigned char *moves, size_t num_bytes,
+                                             unsigned long long first, unsigned long long num_moves, int bits_per_move) {
+    int num_poles = game_state->num_poles;
+    for (unsigned long long i = first; i < num_moves; i++) {
+        int code = read_move_code(moves, num_bytes, i, bits_per_move);
+        int src, dest;
+        if (!decode_move(num_poles, code, &src, &dest) || !is_legal_move(game_state, src, dest)) {
+            return i;
+        }
+        uint64_t *src_mask = pole_mask(game_state, src);
+        uint64_t *dest_mask = pole_mask(game_state, dest);
+        int disk = top_disk(src_mask, game_state->num_words);
+        uint64_t bit = 1ULL << (disk % 64);
+        src_mask[disk / 64] ^= bit;
+        dest_mask[disk / 64] |= bit;
+        game_state->num_moves++;
+        game_state->checksum += move_checksum(game_state->num_moves, src, dest);
+    }
+    return num_moves;
+}
+
+/*
+ * Returns the sum of the checksums of count moves numbered from first, where
+ * move first + j went from pole pairs[j] / MAX_NUM_POLES to pairs[j] %
+ * MAX_NUM_POLES. Each checksum depends only on its move, so unlike checking the
+ * moves this has no serial dependence and the loop is run in SIMD lanes.
+ */
+CLONE_FOR_SIMD
+static unsigned long long sum_move_checksums(unsigned long long first, const unsigned char *pairs, int count) {
+    unsigned long long sum = 0;
+    for (int j = 0; j < count; j++) {
+        sum += move_checksum(first + j, pairs[j] / MAX_NUM_POLES, pairs[j] % MAX_NUM_POLES);
+    }
+    return sum;
+}
+
+/*
+ * Checks blocks of packed moves for at most 64 layers, where each pole's mask
+ * is a single word. Returns the number of moves checked, which stops short of
+ * num_moves at the chunk holding the first illegal move and before the last
+ * few moves, so check_moves_scalar must finish the rest.
+ *
+ * Each block is the moves held in one unaligned 64 bit load, which are split
+ * apart with shifts. The moves depend on each other through the masks so they
+ * cannot be checked in parallel, but each check is branch free: with a and b
+ * the lowest set bits of the src and dest masks (zero for an empty pole), the
+ * move is legal exactly when a - 1 < b - 1 as unsigned numbers. Invalid codes
+ * decode to a move from pole 0 to itself, which always fails that test. The
+ * serial loop only records the poles of each move; the checksums of a chunk of
+ * blocks are summed afterwards by sum_move_checksums. Any failure in a chunk is
+ * only looked at after the chunk, by restoring the state from before it.
+ */
+static unsigned long long check_move_blocks(struct GameState *game_state, const unsigned char *moves, size_t num_bytes,
+                                            unsigned long long num_moves, int bits_per_move) {
+    int num_poles = game_state->num_poles;
+    unsigned char pairs[256];
+    for (int code = 0; code < (1 << bits_per_move); code++) {
+        int src, dest;
+        if (!decode_move(num_poles, code, &src, &dest)) {
+            src = 0;
+            dest = 0;
+        }
+        pairs[code] = src * MAX_NUM_POLES + dest;
+    }
+    uint64_t masks[MAX_NUM_POLES];
+    memcpy(masks, game_state->masks, num_poles * sizeof(*masks));
+    unsigned long long checksum = game_state->checksum;
+    unsigned long long move = game_state->num_moves;
+
+    // A load shifted by up to 7 bits still holds at least 57 bits of moves
+    int block_length = 57 / bits_per_move;
+    int chunk_length = CHECK_CHUNK_BLOCKS * block_length;
+    uint64_t code_mask = (1U << bits_per_move) - 1;
+    unsigned char chunk_pairs[CHECK_CHUNK_BLOCKS * 57];
+    unsigned long long i = 0;
+    while (i + chunk_length <= num_moves && (i + chunk_length) * bits_per_move / 8 + 8 <= num_bytes) {
+        uint64_t saved_masks[MAX_NUM_POLES];
+        memcpy(saved_masks, masks, num_poles * sizeof(*masks));
+        uint64_t illegal = 0;
+        int n = 0;
+        for (int block = 0; block < CHECK_CHUNK_BLOCKS; block++) {
+            unsigned long long bit = (i + n) * bits_per_move;
+            uint64_t codes = get_little_endian(moves + bit / 8, 8) >> (bit % 8);
+            for (int j = 0; j < block_length; j++) {
+                int pair = pairs[codes & code_mask];
+                codes >>= bits_per_move;
+                int src = pair / MAX_NUM_POLES;
+                int dest = pair % MAX_NUM_POLES;
+                uint64_t src_mask = masks[src];
+                uint64_t a = src_mask & -src_mask;
+                uint64_t b = masks[dest] & -masks[dest];
+                illegal |= (a - 1) >= (b - 1);
+                masks[src] = src_mask ^ a;
+                masks[dest] |= a;
+                chunk_pairs[n++] = pair;
+            }
+        }
+        if (illegal) {
+            memcpy(masks, saved_masks, num_poles * sizeof(*masks));
+            break;
+        }
+        checksum += sum_move_checksums(move + 1, chunk_pairs, chunk_length);
+        move += chunk_length;
+        i += chunk_length;
+    }
+    memcpy(game_state->masks, masks, num_poles * sizeof(*masks));
+    game_state->checksum = checksum;
+    game_state->num_moves = move;
+    return i;
+}
+
+/*
+ * Checks packed moves from a binary move log, made up of num_bytes bytes,
+ * against game_state and applies each legal one to it without rendering.
+ * Returns the index of the first illegal move, or num_moves if every move is
+ * legal.
+ */
+unsigned long long check_moves(struct GameState *game_state, const unsigned char *moves, size_t num_bytes,
+                               unsigned long long num_moves, int bits_per_move) {
+    unsigned long long first = 0;
+    if (game_state->num_words == 1) {
+        first = check_move_blocks(game_state, moves, num_bytes, num_moves, bits_per_move);
+    }
+    unsigned long long num_legal = check_moves_scalar(game_state, moves, num_bytes, first, num_moves, bits_per_move);
+    STATS_ADD(moves, num_legal);
+    return num_legal;
+}
+
+/*
+ * Makes and renders packed moves from a binary move log, made up of num_bytes
+ * bytes, stopping before the first illegal one or after one that sets
+ * game_state->error. Returns the number of moves made.
+ */
+unsigned long long replay_moves(struct GameState *game_state, const unsigned char *moves, size_t num_bytes,
+                                unsigned long long num_moves, int bits_per_move) {
+    for (unsigned long long i = 0; i < num_moves; i++) {
+        int code = read_move_code(moves, num_bytes, i, bits_per_move);
+        int src, dest;
+        if (!decode_move(game_state->num_poles, code, &src, &dest) || !is_legal_move(game_state, src, dest)) {
+            return i;
+        }
+        move_disk(game_state, src, dest);
+        if (game_state->error != HANOI_OK) {
+            return i + 1;
+        }
+    }
+    return num_moves;
+}
+
+/*
+ * Makes the moves of the solution after game_state->num_moves up to and
+ * including last_move as described in solve_iterative
+ */
+static void solve_iterative_until(struct GameState *game_state, unsigned long long last_move) {
+    int pole_map[3] = {0, 1, 2};
+    if (game_state->num_layers % 2 == 0) {
+        pole_map[1] = 2;
+        pole_map[2] = 1;
+    }
+    for (unsigned long long k = game_state->num_moves + 1; k <= last_move && game_state->error == HANOI_OK; k++) {
+        int src = pole_map[(k & (k - 1)) % 3];
+        int dest = pole_map[((k | (k - 1)) + 1) % 3];
+        move_disk(game_state, src, dest);
+    }
+}
+
+/*
+ * Solves the puzzle without recursion using the closed form of the solution.
+ * On move k, the disk moved is given by the trailing zeros of k and it goes from
+ * pole (k & (k - 1)) % 3 to pole ((k | (k - 1)) + 1) % 3. That sequence ends
+ * with the tower on pole 2 for an odd number of layers and pole 1 for an even
+ * number, so poles 1 and 2 are swapped in the latter case.
+ *
+ * Continues from game_state->num_moves, so a state set with set_state_at_move
+ * can be resumed. Requires num_poles == 3 and
+ * num_layers <= CLOSED_FORM_MAX_LAYERS.
+ */
+static void solve_iterative(struct GameState *game_state) {
+    solve_iterative_until(game_state, (1ULL << game_state->num_layers) - 1);
+}
+
+/*
+ * Returns whether two game states have the same disks on each pole
+ */
+bool same_poles(struct GameState a, struct GameState b) {
+    return memcmp(a.masks, b.masks, a.num_poles * a.num_words * sizeof(*a.masks)) == 0;
+}
+
+/*
+ * A range of moves solved by one thread of the parallel engine
+ */
+struct Chunk {
+    int num_layers;
+    unsigned long long first_move, last_move; // The one indexed range of moves, inclusive
+    // Set by the thread
+    unsigned long long num_moves;
+    unsigned long long checksum;
+    bool valid; // Whether the chunk ended in the state expected after last_move
+    enum HanoiError error; // Set if the chunk could not be solved
+};
+
+/*
+ * Thread entry point for the parallel engine. Jumps straight to the state
+ * before the first move of the chunk, makes the moves, then checks that the
+ * result matches the state computed directly for the end of the chunk.
+ */
+static void* solve_chunk(void *arg) {
+    struct Chunk *chunk = arg;
+    struct GameState game_state;
+    struct GameState expected;
+    chunk->error = initialize_game_state(&game_state, chunk->num_layers, 3);
+    if (chunk->error != HANOI_OK) {
+        return NULL;
+    }
+    chunk->error = initialize_game_state(&expected, chunk->num_layers, 3);
+    if (chunk->error != HANOI_OK) {
+        destroy_game_state(&game_state);
+        return NULL;
+    }
+    game_state.headless = true;
+    expected.headless = true;
+
+    set_state_at_move(&game_state, chunk->first_move - 1);
+    solve_iterative_until(&game_state, chunk->last_move);
+    set_state_at_move(&expected, chunk->last_move);
+
+    chunk->num_moves = game_state.num_moves - (chunk->first_move - 1);
+    chunk->checksum = game_state.checksum;
+    chunk->valid = same_poles(game_state, expected);
+    destroy_game_state(&game_state);
+    destroy_game_state(&expected);
+    return NULL;
+}
+
+/*
+ * Solves the remaining moves by splitting them into one chunk per thread. The
+ * move counts and checksums of the chunks are merged into game_state, and if
+ * every chunk ended where it should, game_state is set to the solved state.
+ *
+ * Requires num_poles == 3 and num_layers <= CLOSED_FORM_MAX_LAYERS. Moves are not
+ * rendered.
+ */
+static enum HanoiError solve_parallel(struct GameState *game_state, int num_threads) {
+    unsigned long long start = game_state->num_moves;
+    unsigned long long total_moves = (1ULL << game_state->num_layers) - 1;
+    unsigned long long remaining = total_moves - start;
+    if ((unsigned long long) num_threads > remaining) {
+        num_threads = remaining > 0 ? (int) remaining : 1;
+    }
+    struct Chunk *chunks = malloc(num_threads * sizeof(*chunks));
+    pthread_t *threads = malloc(num_threads * sizeof(*threads));
+    if (chunks == NULL || threads == NULL) {
+        free(chunks);
+        free(threads);
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory for %d threads", num_threads);
+    }
+    enum HanoiError result = HANOI_OK;
+    unsigned long long first_move = start + 1;
+    int num_started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        // Spread the remainder over the first chunks
+        unsigned long long length = remaining / num_threads + ((unsigned long long) i < remaining % num_threads);
+        chunks[i].num_layers = game_state->num_layers;
+        chunks[i].first_move = first_move;
+        chunks[i].last_move = first_move + length - 1;
+        first_move += length;
+        int error = pthread_create(&threads[i], NULL, solve_chunk, &chunks[i]);
+        if (error != 0) {
+            result = set_error(HANOI_ERROR_THREAD, "failed to create thread: %s", strerror(error));
+            break;
+        }
+        num_started++;
+    }
+
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // Only whole runs of chunks from the start count, so that the moves made
+    // are always a prefix of the solution
+    for (int i = 0; i < num_started && result == HANOI_OK; i++) {
+        if (chunks[i].error != HANOI_OK) {
+            result = set_error(chunks[i].error, "out of memory solving moves %llu to %llu",
+                               chunks[i].first_move, chunks[i].last_move);
+        } else if (!chunks[i].valid) {
+            result = set_error(HANOI_ERROR_INTERNAL, "moves %llu to %llu did not end in the expected state",
+                               chunks[i].first_move, chunks[i].last_move);
+        } else {
+            game_state->num_moves += chunks[i].num_moves;
+            STATS_ADD(moves, chunks[i].num_moves);
+            game_state->checksum += chunks[i].checksum;
+        }
+    }
+    if (num_started > 0) {
+        // Each chunk started from the state the previous one was checked to end in
+        unsigned long long checksum = game_state->checksum;
+        set_state_at_move(game_state, game_state->num_moves);
+        game_state->checksum = checksum;
+    }
+    free(chunks);
+    free(threads);
+    return result;
+}
+
+/*
+ * Returns the index into a SplitTable for n disks and p poles
+ */
+int split_index(struct SplitTable *table, int n, int p) {
+    return n * (table->max_poles + 1) + p;
+}
+
+/*
+ * Returns the number of moves taken to move n disks with p poles by first
+ * moving the top k disks aside, which must already be in the table. Saturates
+ * at MOVE_COUNT_MAX.
+ */
+static MoveCount split_moves(struct SplitTable *table, int n, int p, int k) {
+    MoveCount top = table->moves[split_index(table, k, p)];
+    MoveCount rest = table->moves[split_index(table, n - k, p - 1)];
+    if (top > MOVE_COUNT_MAX / 2 || MOVE_COUNT_MAX - 2 * top < rest) {
+        return MOVE_COUNT_MAX;
+    }
+    return 2 * top + rest;
+}
+
+/*
+ * Fills in a SplitTable for up to max_disks disks and max_poles poles. The
+ * optimal split never decreases as the number of disks grows and the move count
+ * is convex in the split, so the search for each split starts from the previous
+ * one and stops once the move count starts increasing. This takes amortized
+ * constant time per entry.
+ */
+enum HanoiError initialize_split_table(struct SplitTable *table, int max_disks, int max_poles) {
+    table->max_disks = max_disks;
+    table->max_poles = max_poles;
+    size_t length = (size_t) (max_disks + 1) * (max_poles + 1);
+    table->split = malloc(length * sizeof(*table->split));
+    table->moves = malloc(length * sizeof(*table->moves));
+    if (table->split == NULL || table->moves == NULL) {
+        free(table->split);
+        free(table->moves);
+        return set_error(HANOI_ERROR_NO_MEMORY, "out of memory for the split table");
+    }
+    for (int p = 0; p <= max_poles; p++) {
+        for (int n = 0; n <= max_disks; n++) {
+            int index = split_index(table, n, p);
+            table->split[index] = 0;
+            if (n <= 1 || p < 3) {
+                // A single disk can be moved directly, and more cannot be moved
+                // with fewer than three poles
+                table->moves[index] = n <= 1 ? (MoveCount) n : MOVE_COUNT_MAX;
+                continue;
+            }
+            int k = table->split[split_index(table, n - 1, p)];
+            if (k < 1) {
+                k = 1;
+            }
+            MoveCount best = split_moves(table, n, p, k);
+            while (k + 1 < n) {
+                MoveCount next = split_moves(table, n, p, k + 1);
+                if (next > best) {
+                    break;
+                }
+                best = next;
+                k++;
+            }
+            table->split[index] = k;
+            table->moves[index] = best;
+        }
+    }
+    return HANOI_OK;
+}
+
+/*
+ * Frees dynamically allocated memory
+ */
+void destroy_split_table(struct SplitTable *table) {
+    free(table->split);
+    free(table->moves);
+}
+
+/*
+ * Moves a stack of "size" disks from src to dest using only the poles whose
+ * bits are set in usable, which must include src and dest. Renders each step.
+ * Every call either makes a move or splits the stack into parts that make
+ * moves, so the work per move is constant.
+ */
+static void move_stack_frame_stewart(struct GameState *game_state, int size, int src, int dest, unsigned int usable) {
+    if (size == 0 || game_state->error != HANOI_OK) {
+        return;
+    }
+    if (size == 1) {
+        move_disk(game_state, src, dest);
+        return;
+    }
+    // Move the top disks aside to the first usable spare pole
+    unsigned int spares = usable & ~(1U << src) & ~(1U << dest);
+    int spare = __builtin_ctz(spares);
+    int num_usable = __builtin_popcount(usable);
+    int top = game_state->split_table->split[split_index(game_state->split_table, size, num_usable)];
+    move_stack_frame_stewart(game_state, top, src, spare, usable);
+    move_stack_frame_stewart(game_state, size - top, src, dest, usable & ~(1U << spare));
+    move_stack_frame_stewart(game_state, top, spare, dest, usable);
+}
+
+/*
+ * Fills in targets for gathering disks 0 to top, placed as in poles, into a
+ * single stack on pole. Disk i is moved at most once, onto targets[i], with the
+ * disks above it stacked on the third pole beforehand and moved on top of it
+ * afterwards, so disks 0 to i end up on targets[i]. Returns the number of moves
+ * this takes. The reverse scatters a stack on pole into poles.
+ */
+static MoveCount gather_targets(const int *poles, int top, int pole, int targets[]) {
+    MoveCount moves = 0;
+    for (int i = top; i >= 0; i--) {
+        targets[i] = pole;
+        if (poles[i] != pole) {
+            // Gathering the disks above, moving disk i and moving i disks on top of it
+            moves += (MoveCount) 1 << i;
+            pole = 3 - poles[i] - pole;
+        }
+    }
+    return moves;
+}
+
+/*
+ * Moves the top size disks from src to dest in the 2^size - 1 moves of the
+ * usual solution, computing each move from the bits of its number as
+ * solve_iterative does. Requires 3 poles and size < 64.
+ */
+static void move_stack_iterative(struct GameState *game_state, int size, int src, int dest) {
+    int spare = 3 - src - dest;
+    // An odd stack goes straight to the third pole of the solution, an even one to the second
+    int pole_map[3] = {src, spare, dest};
+    if (size % 2 == 0) {
+        pole_map[1] = dest;
+        pole_map[2] = spare;
+    }
+    unsigned long long num_moves = (1ULL << size) - 1;
+    for (unsigned long long k = 1; k <= num_moves && game_state->error == HANOI_OK; k++) {
+        move_disk(game_state, pole_map[(k & (k - 1)) % 3], pole_map[((k | (k - 1)) + 1) % 3]);
+    }
+}
+
+/*
+ * Gathers disks 0 to top, placed as in poles, into a single stack on pole as
+ * described in gather_targets
+ */
+static void gather_stack(struct GameState *game_state, const int *poles, int top, int pole) {
+    int targets[CLOSED_FORM_MAX_LAYERS];
+    gather_targets(poles, top, pole, targets);
+    for (int i = 0; i <= top && game_state->error == HANOI_OK; i++) {
+        if (poles[i] != targets[i]) {
+            // Disks 0 to i - 1 were gathered on the third pole
+            int above = 3 - poles[i] - targets[i];
+            move_disk(game_state, poles[i], targets[i]);
+            move_stack_iterative(game_state, i, above, targets[i]);
+        }
+    }
+}
+
+/*
+ * Scatters the stack of disks 0 to top on pole so that disk i ends on poles[i],
+ * making the moves of gather_stack in reverse
+ */
+static void scatter_stack(struct GameState *game_state, const int *poles, int top, int pole) {
+    int targets[CLOSED_FORM_MAX_LAYERS];
+    gather_targets(poles, top, pole, targets);
+    for (int i = top; i >= 0 && game_state->error == HANOI_OK; i--) {
+        if (poles[i] != targets[i]) {
+            int above = 3 - poles[i] - targets[i];
+            move_stack_iterative(game_state, i, targets[i], above);
+            move_disk(game_state, targets[i], poles[i]);
+        }
+    }
+}
+
+/*
+ * The optimal way between two configurations of three poles. Only the largest
+ * disk that is out of place and those above it move. It either moves once, from
+ * its pole a to its goal b, with the disks above it gathered on the third pole
+ * c, or twice, through c, with the disks above it gathered on b then moved to a
+ * while it is on c. The second can be shorter when the disks above it are
+ * mostly on c already and end up mostly on a.
+ */
+struct ConfigurationPlan {
+    int disk; // The largest disk out of place, or -1 if there is none
+    int from, to; // Where disk starts and ends
+    bool twice; // Whether disk moves through the third pole
+    MoveCount moves;
+};
+
+/*
+ * Fills in the plan from the current state of game_state to game_state->goal,
+ * with the pole of every disk written to poles. Requires 3 poles and at most
+ * CLOSED_FORM_MAX_LAYERS layers.
+ */
+static struct ConfigurationPlan plan_configuration(struct GameState *game_state, int poles[]) {
+    for (int i = 0; i < game_state->num_layers; i++) {
+        poles[i] = 0;
+        while (!has_disk(pole_mask(game_state, poles[i]), i)) {
+            poles[i]++;
+        }
+    }
+    struct ConfigurationPlan plan;
+    plan.disk = game_state->num_layers - 1;
+    while (plan.disk >= 0 && poles[plan.disk] == game_state->goal[plan.disk]) {
+        plan.disk--;
+    }
+    plan.twice = false;
+    plan.moves = 0;
+    if (plan.disk == -1) {
+        return plan;
+    }
+    int k = plan.disk;
+    plan.from = poles[k];
+    plan.to = game_state->goal[k];
+    int third = 3 - plan.from - plan.to;
+    int targets[CLOSED_FORM_MAX_LAYERS];
+    MoveCount once = gather_targets(poles, k - 1, third, targets) + 1 +
+                     gather_targets(game_state->goal, k - 1, third, targets);
+    MoveCount twice = gather_targets(poles, k - 1, plan.to, targets) + 1 + (((MoveCount) 1 << k) - 1) + 1 +
+                      gather_targets(game_state->goal, k - 1, plan.from, targets);
+    plan.twice = twice < once;
+    plan.moves = plan.twice ? twice : once;
+    return plan;
+}
+
+/*
+ * Returns the number of moves the configuration engine takes to solve
+ * game_state from its current state, or 0 if it cannot solve it
+ */
+MoveCount configuration_moves(struct GameState *game_state) {
+    if (game_state->num_poles != 3 || game_state->num_layers > CLOSED_FORM_MAX_LAYERS ||
+            game_state->goal == NULL) {
+        return 0;
+    }
+    int poles[CLOSED_FORM_MAX_LAYERS];
+    return plan_configuration(game_state, poles).moves;
+}
+
+/*
+ * Makes the optimal moves from the current state of game_state to
+ * game_state->goal, as planned by plan_configuration. Each move is computed in
+ * constant time, keeping only O(num_layers) state.
+ */
+static void solve_configuration(struct GameState *game_state) {
+    int poles[CLOSED_FORM_MAX_LAYERS];
+    struct ConfigurationPlan plan = plan_configuration(game_state, poles);
+    if (plan.disk == -1) {
+        return;
+    }
+    int k = plan.disk;
+    int third = 3 - plan.from - plan.to;
+    if (plan.twice) {
+        gather_stack(game_state, poles, k - 1, plan.to);
+        move_disk(game_state, plan.from, third);
+        move_stack_iterative(game_state, k, plan.to, plan.from);
+        move_disk(game_state, third, plan.to);
+        scatter_stack(game_state, game_state->goal, k - 1, plan.from);
+    } else {
+        gather_stack(game_state, poles, k - 1, third);
+        move_disk(game_state, plan.from, plan.to);
+        scatter_stack(game_state, game_state->goal, k - 1, third);
+    }
+}
+
+/*
+ * Moves every disk from the first pole to the last using the given engine,
+ * continuing from game_state->num_moves if moves have already been made. Only
+ * the recursive, iterative and parallel engines can continue. The configuration
+ * engine instead moves from whatever the state is to game_state->goal.
+ * num_threads is only used by the parallel engine, and the Frame-Stewart engine
+ * requires game_state->split_table to be filled in. The iterative, parallel and
+ * configuration engines require 3 poles and at most CLOSED_FORM_MAX_LAYERS
+ * layers, and the parallel engine cannot render, log, queue, checkpoint or pass
+ * moves to a sink.
+ * Returns the error that stopped the solve, if any.
+ */
+enum HanoiError solve_hanoi(struct GameState *game_state, enum Engine engine, int num_threads) {
+    bool closed_form = engine == ENGINE_ITERATIVE || engine == ENGINE_PARALLEL || engine == ENGINE_CONFIGURATION;
+    if (closed_form && (game_state->num_poles != 3 || game_state->num_layers > CLOSED_FORM_MAX_LAYERS)) {
+        static const char *names[] = {"recursive", "iterative", "parallel", "frame-stewart", "configuration"};
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT, "the %s engine requires 3 poles and at most %d layers",
+                         names[engine], CLOSED_FORM_MAX_LAYERS);
+    }
+    if (engine == ENGINE_CONFIGURATION && game_state->goal == NULL) {
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT, "the configuration engine needs a goal");
+    }
+    if (engine == ENGINE_PARALLEL && (!game_state->headless || game_state->move_log != NULL ||
+                                      game_state->move_sink != NULL || game_state->move_queue != NULL ||
+                                      game_state->checkpointer != NULL)) {
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT, "the parallel engine only solves headless");
+    }
+    if (engine == ENGINE_FRAME_STEWART && (game_state->split_table == NULL || game_state->num_moves > 0)) {
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT,
+                         "the Frame-Stewart engine needs a split table and cannot continue");
+    }
+    switch (engine) {
+    case ENGINE_RECURSIVE:
+        resume_stack(game_state, game_state->num_layers, 0, game_state->num_poles - 1, game_state->num_moves);
+        break;
+    case ENGINE_ITERATIVE:
+        solve_iterative(game_state);
+        break;
+    case ENGINE_PARALLEL:
+        game_state->error = solve_parallel(game_state, num_threads);
+        break;
+    case ENGINE_FRAME_STEWART:
+        move_stack_frame_stewart(game_state, game_state->num_layers, 0, game_state->num_poles - 1,
+                                 (1U << game_state->num_poles) - 1);
+        break;
+    case ENGINE_CONFIGURATION:
+        solve_configuration(game_state);
+        break;
+    }
+    return game_state->error;
+}
+
+/*
+ * Returns whether every disk is on its pole in game_state.goal, or on the last
+ * pole if there is no goal
+ */
+bool is_solved(struct GameState game_state) {
+    for (int i = 0; i < game_state.num_layers; i++) {
+        int pole = game_state.goal != NULL ? game_state.goal[i] : game_state.num_poles - 1;
+        if (!has_disk(pole_mask(&game_state, pole), i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Continues game_state from a checkpoint after checking it against the state
+ * computed directly from its number of moves.
+ * Requires 3 poles and at most CLOSED_FORM_MAX_LAYERS layers.
+ */
+enum HanoiError restore_checkpoint(struct GameState *game_state, struct Checkpoint checkpoint) {
+    if (checkpoint.num_layers != game_state->num_layers || checkpoint.num_poles != game_state->num_poles) {
+        return set_error(HANOI_ERROR_INVALID_ARGUMENT, "checkpoint is for %d layers and %d poles",
+                         checkpoint.num_layers, checkpoint.num_poles);
+    }
+    if (checkpoint.num_moves > game_state->total_moves) {
+        return set_error(HANOI_ERROR_INVALID_FILE, "checkpoint is past the end of the solution");
+    }
+    enum HanoiError error = set_state_at_move(game_state, (unsigned long long) checkpoint.num_moves);
+    if (error != HANOI_OK) {
+        return error;
+    }
+    struct GameState saved = *game_state;
+    saved.masks = checkpoint.masks;
+    if (!same_poles(*game_state, saved)) {
+        return set_error(HANOI_ERROR_INVALID_FILE, "checkpoint does not match the state after its number of moves");
+    }
+    game_state->checksum = checkpoint.checksum;
+    return HANOI_OK;
+}
+
+/*
+ * Gets the size of the terminal stdout is written to. Returns false if it is
+ * not known, such as when stdout is not a terminal.
+ */
+static bool get_terminal_size(int *rows, int *columns) {
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+        return false;
+    }
+    *rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+    *columns = info.srWindow.Right - info.srWindow.Left + 1;
+#else
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == -1 || size.ws_row == 0 || size.ws_col == 0) {
+        return false;
+    }
+    *rows = size.ws_row;
+    *columns = size.ws_col;
+#endif
+    return true;
+}
+
+/*
+ * Sizes the viewport of game_state to the terminal, or turns it off if the
+ * tower fits. One line is left for the moves and one for the cursor.
+ */
+static void fit_viewport(struct GameState *game_state) {
+    int rows, columns;
+    if (!get_terminal_size(&rows, &columns)) {
+        rows = DEFAULT_TERMINAL_ROWS;
+        columns = DEFAULT_TERMINAL_COLUMNS;
+    }
+    int available_rows = rows > 3 ? rows - 2 : 1;
+    int spacing = (game_state->num_poles - 1) * SPACE_BETWEEN_POLES;
+    int available_width = (columns - spacing) / game_state->num_poles;
+    if (available_width % 2 == 0) {
+        available_width--;
+    }
+    if (available_width < 1) {
+        available_width = 1;
+    }
+
+    struct Viewport *viewport = &game_state->viewport;
+    long long full_width = 2LL * game_state->num_layers - 1;
+    if (game_state->num_layers <= available_rows && full_width <= available_width) {
+        viewport->mode = VIEWPORT_NONE;
+        return;
+    }
+    if (viewport->mode == VIEWPORT_SCALE) {
+        // Two layers fit in each line
+        long long lines = (game_state->num_layers + 1LL) / 2;
+        viewport->rows = lines < available_rows ? lines : available_rows;
+    } else {
+        viewport->rows = game_state->num_layers < available_rows ? game_state->num_layers : available_rows;
+    }
+    viewport->pole_width = full_width < available_width ? full_width : available_width;
+}
+
+/*
+ * Sets up everything needed to render game_state in its current state with the
+ * colors of colormap, which is no longer needed afterwards. The poles, disks
+ * and frame buffer are sized up front and allocated from a single arena, so
+ * that a solve makes one allocation for rendering and drawing makes none. The
+ * text backend draws without colors, so it sets the color mode to COLOR_NONE.
+ */
+enum HanoiError initialize_rendering(struct GameState *game_state, struct ColorMap colormap) {
+    if (game_state->backend == BACKEND_TEXT) {
+        game_state->color_mode = COLOR_NONE;
+    }
+    if (game_state->viewport.mode != VIEWPORT_NONE) {
+        fit_viewport(game_state);
+    }
+    bool viewport = game_state->viewport.mode != VIEWPORT_NONE;
+    int num_layers = game_state->num_layers;
+    int num_poles = game_state->num_poles;
+    size_t buffer_size;
+    if (viewport) {
+        // Each pole changes color at most four times per line, and the buffer grows if needed
+        buffer_size = frame_buffer_size(game_state->viewport.pole_width / 2 + 1, num_poles) +
+                      game_state->viewport.rows * num_poles * 8 * COLOR_OVERHEAD;
+    } else {
+        buffer_size = frame_buffer_size(num_layers, num_poles);
+    }
+    bool cast = game_state->backend == BACKEND_CAST;
+    // A cast line holds the header and a whole frame, escaped
+    size_t line_size = cast ? buffer_size * JSON_ESCAPE_MAX_LENGTH + 2 * CAST_LINE_OVERHEAD : 0;
+    size_t cast_size = cast ? arena_round(sizeof(*game_state->cast)) + arena_round(line_size) : 0;
+    enum HanoiError error = reserve_arena(&game_state->arena, disks_arena_size(num_layers, !viewport) +
+                                          poles_arena_size(num_poles, num_layers) +
+                                          arena_round(sizeof(*game_state->frame_buffer)) +
+                                          arena_round(buffer_size) + cast_size);
+    if (error != HANOI_OK) {
+        return error;
+    }
+
+    game_state->disks = create_disks(num_layers, colormap, game_state->color_mode, !viewport, &game_state->arena);
+    game_state->rod_span = viewport ? NULL : create_rod_span(num_layers, &game_state->arena);
+    game_state->rod_span_length = viewport ? 0 : rod_span_size(num_layers);
+    game_state->poles = create_poles(num_poles, num_layers, &game_state->arena);
+    struct FrameBuffer *frame_buffer = arena_alloc(&game_state->arena, sizeof(*frame_buffer));
+    char *data = arena_alloc(&game_state->arena, buffer_size);
+    struct CastWriter *writer = cast ? arena_alloc(&game_state->arena, sizeof(*writer)) : NULL;
+    char *line = cast ? arena_alloc(&game_state->arena, line_size) : NULL;
+    // The arena is sized for all of these, so this should not occur
+    if (game_state->disks == NULL || game_state->poles == NULL || frame_buffer == NULL || data == NULL ||
+            (!viewport && game_state->rod_span == NULL) || (cast && (writer == NULL || line == NULL))) {
+        game_state->poles = NULL;
+        game_state->disks = NULL;
+        game_state->rod_span = NULL;
+        return set_error(HANOI_ERROR_INTERNAL, "rendering arena is too small");
+    }
+    sync_poles(*game_state);
+    game_state->frame_buffer = frame_buffer;
+    initialize_frame_buffer_with(frame_buffer, data, buffer_size);
+    if (cast) {
+        initialize_frame_buffer_with(&writer->line, line, line_size);
+        // The poles are separated by spaces, with a line for the moves and one for the cursor
+        writer->width = num_poles * game_state->viewport.pole_width + (num_poles - 1) * SPACE_BETWEEN_POLES;
+        writer->height = game_state->viewport.rows + 2;
+        writer->start_time = 0;
+        writer->delay_seconds = 0;
+        writer->num_frames = 0;
+    }
+    game_state->cast = writer;
+    return HANOI_OK;
+}
+
+/*
+ * Stops rendering game_state. The arena is kept for the next
+ * initialize_rendering and freed by destroy_game_state.
+ */
+void destroy_rendering(struct GameState *game_state) {
+    // Only frees the frame buffer's data if it outgrew the arena
+    destroy_frame_buffer(game_state->frame_buffer);
+    if (game_state->cast != NULL) {
+        destroy_frame_buffer(&game_state->cast->line);
+        game_state->cast = NULL;
+    }
+    game_state->poles = NULL;
+    game_state->disks = NULL;
+    game_state->rod_span = NULL;
+    game_state->frame_buffer = NULL;
+}
+
+/*
+ * The state shared with the render thread
+ */
+struct RenderThread {
+    struct GameState *game_state; // The render thread's own copy of the game
+    struct MoveQueue *queue;
+    enum RenderPolicy policy;
+    char error_message[ERROR_MESSAGE_MAX_LENGTH]; // Set if rendering failed
+#ifdef HANOI_STATS
+    struct Stats stats; // The render thread's counters, set when it finishes
+#endif
+};
+
+/*
+ * Thread entry point for rendering. Makes the moves taken from the queue on its
+ * own copy of the game, drawing them according to the policy, until the queue
+ * is closed and empty. Once rendering fails, the moves are only drained.
+ */
+static void* render_queued_moves(void *arg) {
+    struct RenderThread *render = arg;
+    struct GameState *game_state = render->game_state;
+    struct MoveQueue *queue = render->queue;
+    size_t mask = queue->capacity - 1;
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    while (true) {
+        // Read closed first so that every move is seen once it is set
+        bool closed = atomic_load_explicit(&queue->closed, memory_order_acquire);
+        size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (head == tail) {
+            if (closed) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        if (game_state->error != HANOI_OK) {
+            // Rendering failed, so only drain the queue
+            tail = head;
+        }
+        for (; tail != head; tail++) {
+            unsigned char move = queue->moves[tail & mask];
+            game_state->skip_frames = render->policy == RENDER_SKIP && tail + 1 != head;
+            move_disk(game_state, move >> 4, move & 0xf);
+            if (render->policy == RENDER_BLOCK) {
+                // Free the slot as soon as possible since each move may take a whole frame
+                atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+            }
+        }
+        atomic_store_explicit(&queue->tail, tail, memory_order_release);
+    }
+    game_state->skip_frames = false;
+    if (game_state->error == HANOI_OK) {
+        finish_animation(*game_state);
+        game_state->error = game_state->frame_buffer->error;
+    }
+    if (game_state->error != HANOI_OK) {
+        snprintf(render->error_message, sizeof(render->error_message), "%s", get_error_message());
+    }
+#ifdef HANOI_STATS
+    render->stats = stats;
+#endif
+    return NULL;
+}
+
+/*
+ * Solves game_state on this thread while a second thread renders the moves
+ * from its own copy of the game, so that neither waits on the other unless the
+ * move queue fills up. Returns the error that stopped the solve or the
+ * rendering, if any.
+ */
+enum HanoiError solve_with_render_thread(struct GameState *game_state, enum Engine engine, int num_threads,
+                                         enum RenderPolicy policy, struct ColorMap colormap) {
+    struct GameState render_state;
+    enum HanoiError error = initialize_game_state(&render_state, game_state->num_layers, game_state->num_poles);
+    if (error != HANOI_OK) {
+        return error;
+    }
+    memcpy(render_state.masks, game_state->masks,
+           game_state->num_poles * game_state->num_words * sizeof(*game_state->masks));
+    render_state.backend = game_state->backend;
+    render_state.differential = game_state->differential;
+    render_state.delay_ms = game_state->delay_ms;
+    render_state.color_mode = game_state->color_mode;
+    render_state.viewport = game_state->viewport;
+    render_state.fps = game_state->fps;
+    render_state.next_frame = game_state->next_frame;
+    render_state.total_moves = game_state->total_moves;
+    render_state.num_moves = game_state->num_moves;
+    render_state.checksum = game_state->checksum;
+    error = initialize_rendering(&render_state, colormap);
+    if (error != HANOI_OK) {
+        destroy_game_state(&render_state);
+        return error;
+    }
+    draw(render_state);
+
+    struct MoveQueue queue;
+    error = initialize_move_queue(&queue, MOVE_QUEUE_CAPACITY);
+    if (error != HANOI_OK) {
+        destroy_rendering(&render_state);
+        destroy_game_state(&render_state);
+        return error;
+    }
+    struct RenderThread render;
+    render.game_state = &render_state;
+    render.queue = &queue;
+    render.policy = policy;
+    pthread_t thread;
+    int thread_error = pthread_create(&thread, NULL, render_queued_moves, &render);
+    if (thread_error != 0) {
+        destroy_move_queue(&queue);
+        destroy_rendering(&render_state);
+        destroy_game_state(&render_state);
+        return set_error(HANOI_ERROR_THREAD, "failed to create thread: %s", strerror(thread_error));
+    }
+
+    bool headless = game_state->headless;
+    game_state->headless = true;
+    game_state->move_queue = &queue;
+    STATS_TIME_START(start);
+    error = solve_hanoi(game_state, engine, num_threads);
+    STATS_TIME_END(solve_seconds, start);
+    close_move_queue(&queue);
+    pthread_join(thread, NULL);
+    game_state->headless = headless;
+    game_state->move_queue = NULL;
+    if (error == HANOI_OK && render_state.error != HANOI_OK) {
+        // The render thread's message is its own, so copy it to this thread
+        error = set_error(render_state.error, "%s", render.error_message);
+    }
+
+#ifdef HANOI_STATS
+    // The moves were already counted by the solver
+    stats.frames += render.stats.frames;
+    stats.bytes += render.stats.bytes;
+    stats.escapes += render.stats.escapes;
+    stats.writes += render.stats.writes;
+    stats.render_seconds += render.stats.render_seconds;
+    stats.write_seconds += render.stats.write_seconds;
+    stats.sleep_seconds += render.stats.sleep_seconds;
+#endif
+    destroy_move_queue(&queue);
+    destroy_rendering(&render_state);
+    destroy_game_state(&render_state);
+    return error;
+}
+
+/*
+ * Prints the counters in Stats. elapsed is the total time taken to solve, which
+ * includes rendering, writing and sleeping. The time to the first frame is
+ * measured from startup_time, which is left out if it is 0.
+ */
+void print_stats(FILE *file, double elapsed, double startup_time) {
+#ifdef HANOI_STATS
+    double solve_seconds = stats.solve_seconds > 0 ? stats.solve_seconds :
+                           elapsed - stats.render_seconds - stats.write_seconds - stats.sleep_seconds;
+    fprintf(file, "Stats:\n");
+    fprintf(file, "    Moves: %llu\n", stats.moves);
+    fprintf(file, "    Frames: %llu\n", stats.frames);
+    fprintf(file, "    Bytes written: %llu (%.1f per frame)\n", stats.bytes,
+            stats.frames > 0 ? (double) stats.bytes / stats.frames : 0);
+    fprintf(file, "    Escape sequences: %llu\n", stats.escapes);
+    fprintf(file, "    Write calls: %llu\n", stats.writes);
+    fprintf(file, "    Time solving: %.6f s\n", solve_seconds);
+    fprintf(file, "    Time rendering: %.6f s\n", stats.render_seconds);
+    fprintf(file, "    Time writing: %.6f s\n", stats.write_seconds);
+    fprintf(file, "    Time sleeping: %.6f s\n", stats.sleep_seconds);
+    if (startup_time > 0 && stats.first_frame_time > 0) {
+        fprintf(file, "    Time to first frame: %.6f s\n", stats.first_frame_time - startup_time);
+    }
+#else
+    (void) file;
+    (void) elapsed;
+    (void) startup_time;
+#endif
+}
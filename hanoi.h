@@ -0,0 +1,435 @@
+/*
+ * libhanoi solves, renders and checks the Tower of Hanoi. Every function that
+ * can fail returns an enum HanoiError instead of exiting, with a message for
+ * get_error_message, so that it can be driven from another program. Each
+ * function is documented where it is defined in hanoi.c.
+ */
+#ifndef HANOI_H
+#define HANOI_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define DEFAULT_NUM_POLES 3
+#define MAX_NUM_POLES 16
+#define ANIMATION_DELAY_MS 200 // Default delay between animation draws in milliseconds
+#define MAX_FPS 1000
+#define S_TO_NS_MULTIPLIER 1000000000 // 1 second = 1,000,000,000 nanoseconds
+
+// The closed form solution counts moves in an unsigned long long, so
+// 2^num_layers - 1 must fit in one
+#define CLOSED_FORM_MAX_LAYERS 63
+
+#define DEFAULT_CHECKPOINT_INTERVAL_S 60
+#define ERROR_MESSAGE_MAX_LENGTH 256 // Longer messages are truncated
+
+/*
+ * Counts moves, whose number grows exponentially with the number of layers. It
+ * is 128 bits where the compiler supports it, enough for every move of up to
+ * 127 layers, so incrementing it stays a single add. Counts that do not fit
+ * saturate at MOVE_COUNT_MAX.
+ */
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 MoveCount;
+#define MOVE_COUNT_BITS 128
+#else
+typedef unsigned long long MoveCount;
+#define MOVE_COUNT_BITS 64
+#endif
+#define MOVE_COUNT_MAX ((MoveCount) -1)
+#define MOVE_COUNT_MAX_DIGITS 39 // The number of decimal digits in MOVE_COUNT_MAX
+
+/*
+ * The errors returned by the library. A message describing the last error on
+ * each thread is kept for get_error_message.
+ */
+enum HanoiError {
+    HANOI_OK,
+    HANOI_ERROR_NO_MEMORY,
+    HANOI_ERROR_INVALID_ARGUMENT, // A value out of range or a combination that is not supported
+    HANOI_ERROR_INVALID_FILE, // A colormap, move log or checkpoint that could not be parsed
+    HANOI_ERROR_IO, // Reading or writing a file failed
+    HANOI_ERROR_THREAD, // A thread could not be created
+    HANOI_ERROR_ILLEGAL_MOVE, // A disk was moved onto a smaller one or from an empty pole
+    HANOI_ERROR_STOPPED, // The move sink asked for the solve to stop
+    HANOI_ERROR_INTERNAL // A check of the library's own results failed, which should not occur
+};
+
+/*
+ * Receives each move as it is made, along with the context it was set with.
+ * Returns false to stop the solve.
+ */
+typedef bool (*MoveSink)(void *context, int src, int dest);
+
+/*
+ * Stores an rgb value as a triplet of bytes
+ */
+struct Color {
+    int r, g, b;
+};
+
+/*
+ * Stores a color map for converting from a scalar to a color.
+ * It is stored as an array where each color is equally spaced. THe length is
+ * the number of color values.
+ */
+struct ColorMap {
+    const struct Color *colors;
+    int length;
+};
+
+/*
+ * How disk colors are written to the terminal. Colors are quantized to the
+ * nearest one the mode supports, which gives shorter escape sequences.
+ */
+enum ColorMode {
+    COLOR_TRUECOLOR, // 24 bit \033[38;2;r;g;bm
+    COLOR_256, // The xterm 256 color palette, \033[38;5;nm
+    COLOR_16, // The 16 ANSI colors, \033[3nm and \033[9nm
+    COLOR_NONE // No colors, only the shapes of the disks
+};
+
+/*
+ * Stores how a single disk is drawn. Disks are identified by their index, with
+ * disk 0 being the smallest.
+ */
+struct Disk {
+    int size; // The size of the disk
+    struct Color color; // The color of the disk
+    // The layer of a pole the disk is on prerendered as the padding, one color
+    // prefix, 2 * size - 1 blocks, one reset and the padding again, so that it
+    // is the full width of a pole. It is not null terminated.
+    // NULL when drawing through a viewport, which scales the disks instead.
+    char *span;
+    int span_length;
+};
+
+/*
+ * How a tower too large for the terminal is drawn
+ */
+enum ViewportMode {
+    VIEWPORT_NONE, // Draw every layer at full width
+    VIEWPORT_SCALE, // Scale every layer down to fit, two layers per line
+    VIEWPORT_TOP // Draw only the top layers of each pole, with the widths scaled down
+};
+
+/*
+ * The part of the terminal a tower is drawn in when it does not fit
+ */
+struct Viewport {
+    enum ViewportMode mode; // VIEWPORT_NONE if the tower fits
+    int rows; // The number of lines the poles are drawn in
+    int pole_width; // The number of columns each pole is drawn in, always odd
+};
+
+/*
+ * A block of memory that allocations are carved out of in order and freed all
+ * at once
+ */
+struct Arena {
+    char *data;
+    size_t size;
+    size_t used;
+};
+
+/*
+ * Stores the disks on a single pole as they are drawn. The solver only uses the
+ * bitmasks in GameState, so poles are only kept when rendering.
+ */
+struct Pole {
+    int num_disk; // The current number of disks on the pole
+    int *disks; // Array storing the index of each disk with lower ones closer to bottom.
+    // The range of layers that changed since the last frame was drawn.
+    // The range is empty when dirty_low > dirty_high.
+    int dirty_low, dirty_high;
+};
+
+/*
+ * A growable byte buffer that a whole frame is rendered into so that it can be
+ * written to the terminal with a single call.
+ */
+struct FrameBuffer {
+    char *data;
+    size_t length; // The number of bytes currently in the buffer
+    size_t capacity; // The number of bytes allocated
+    bool owns_data; // Whether data was allocated by the buffer rather than given to it
+    // Set if growing or writing out the buffer failed. Output that did not fit
+    // is dropped.
+    enum HanoiError error;
+    FILE *file; // Where the buffer is flushed to, stdout by default
+    unsigned long long bytes_written; // The total number of bytes flushed
+    unsigned long long num_flushes;
+};
+
+/*
+ * Where rendered frames go. Each backend only pays for the output it needs.
+ */
+enum Backend {
+    BACKEND_TERMINAL, // Escape sequences that redraw each frame over the last one
+    BACKEND_NULL, // Frames are rendered as for the terminal but dropped instead of written or slept on
+    BACKEND_TEXT, // Whole frames one after another without escape sequences or colors, for pipes and logs
+    // An asciinema v2 recording of the terminal output, with the delays recorded
+    // in the timestamps instead of slept
+    BACKEND_CAST
+};
+
+/*
+ * The formats a move log can be written in
+ */
+enum MoveLogFormat {
+    MOVE_LOG_TEXT, // One "src dest" line per move
+    MOVE_LOG_BINARY // A header followed by the moves packed into bits
+};
+
+/*
+ * Writes each move to a file as it is made.
+ *
+ * A binary log starts with a MOVE_LOG_HEADER_SIZE byte header of little endian
+ * fields:
+ *     0  MOVE_LOG_MAGIC
+ *     8  uint32 number of layers
+ *     12 uint16 number of poles
+ *     14 uint8  bits per move
+ *     15 uint8  reserved, always 0
+ *     16 uint128 number of moves made before the log starts
+ *     32 uint128 number of moves in the log
+ * Then each move is stored in bits_per_move bits as encode_move(src, dest),
+ * packed from the least significant bit of each byte up.
+ */
+struct MoveLog {
+    FILE *file;
+    enum MoveLogFormat format;
+    int num_poles;
+    int bits_per_move;
+    struct FrameBuffer buffer; // Holds output until there is a large block to write
+    uint64_t bits; // Packed moves that do not fill up a word yet
+    int num_bits;
+    enum HanoiError error; // Set if writing the log failed
+};
+
+/*
+ * The fields of the header of a binary move log
+ */
+struct MoveLogHeader {
+    int header_size; // Where the moves start, which depends on the version
+    int num_layers;
+    int num_poles;
+    int bits_per_move;
+    // The counts are stored in 128 bits, but a log that can be replayed has
+    // fewer moves than that, since it would not fit on disk otherwise
+    unsigned long long start_move; // The number of moves made before the log starts
+    unsigned long long num_moves; // The number of moves in the log
+};
+
+/*
+ * A file mapped into memory, or read into memory where mapping is not available
+ */
+struct MappedFile {
+    unsigned char *data;
+    size_t length;
+};
+
+/*
+ * The algorithms that can be used to solve the puzzle
+ */
+enum Engine {
+    ENGINE_RECURSIVE, // Recursively moves stacks of disks with move_stack
+    ENGINE_ITERATIVE, // Computes each move from the bits of the move number
+    ENGINE_PARALLEL, // Splits the moves into chunks solved iteratively on separate threads
+    ENGINE_FRAME_STEWART, // Uses every pole with the Frame-Stewart algorithm
+    ENGINE_CONFIGURATION // Moves from any configuration to the one in GameState.goal
+};
+
+/*
+ * Memoizes the Frame-Stewart algorithm. Moving n disks using p poles is done by
+ * moving the top split(n, p) disks to a spare pole using all p poles, moving the
+ * rest using the p - 1 poles left, then moving the top disks back on top.
+ * Both tables are indexed by [n * (max_poles + 1) + p]. Move counts saturate at
+ * MOVE_COUNT_MAX.
+ */
+struct SplitTable {
+    int max_disks, max_poles;
+    int *split; // The number of disks to move aside first
+    MoveCount *moves; // The minimum number of moves
+};
+
+/*
+ * Stores information about the overall state of the game
+ */
+struct GameState {
+    // Bit i of a pole's mask is set if disk i is on it. The disks on a pole are
+    // always in order, so the masks are the whole state of the puzzle and the
+    // top disk of a pole is its lowest set bit. Each mask is num_words long, with
+    // the mask of pole i starting at masks[i * num_words].
+    uint64_t *masks;
+    int num_words;
+    size_t masks_capacity; // The number of words allocated for masks
+    // Used for rendering, both NULL when headless. They and the frame buffer are
+    // allocated from arena, which is kept until destroy_game_state so that
+    // rendering can be set up again without allocating.
+    struct Pole *poles; // Points to array of poles
+    struct Arena arena;
+    struct Disk *disks; // Points to array of disks indexed by disk
+    // A layer of a pole with no disk prerendered as the rod and its padding, as
+    // the spans of the disks are. NULL when drawing through a viewport.
+    char *rod_span;
+    int rod_span_length;
+    struct FrameBuffer *frame_buffer; // The buffer frames are rendered into
+    enum Backend backend; // Where frames go once they are rendered
+    struct CastWriter *cast; // Records the frames for BACKEND_CAST, from arena, otherwise NULL
+    // Whether redraws only rewrite the layers that changed instead of the whole frame
+    bool differential;
+    enum ColorMode color_mode; // How the disks are colored
+    struct Viewport viewport;
+    bool headless; // Whether to skip rendering entirely
+    int delay_ms; // The delay after each frame is drawn in milliseconds
+    // The target frame rate, or 0 to draw after every move. Moves between
+    // frames are skipped, with the dirty ranges of the poles building up.
+    int fps;
+    double next_frame; // The time the next frame is due when fps is set
+    bool skip_frames; // Set while moves are applied without being drawn
+    int num_layers; // The total number of layers
+    int num_poles; // The total number of poles
+    MoveCount total_moves; // The number of moves the solution takes, MOVE_COUNT_MAX if too many to count
+    struct SplitTable *split_table; // Only used by the Frame-Stewart engine
+    // The pole each disk, counting from the smallest, ends on. Only used by the
+    // configuration engine, and NULL for every disk on the last pole.
+    const int *goal;
+    struct MoveLog *move_log; // Where moves are written as they are made, or NULL
+    struct MoveQueue *move_queue; // Where moves are sent to be rendered by another thread, or NULL
+    struct Checkpointer *checkpointer; // Saves the state every so often, or NULL
+    MoveSink move_sink; // Called after each move, or NULL
+    void *move_sink_context;
+    // The first error while solving, which stops the solve. The rest of the
+    // state is left as it was after the last move made.
+    enum HanoiError error;
+    // Tracks the number of moves made so far
+    MoveCount num_moves;
+    // The sum of move_checksum over every move made. Being a sum, the checksums
+    // of separately solved ranges of moves can be merged by adding them.
+    unsigned long long checksum;
+};
+
+/*
+ * A snapshot of a solve in progress that it can be resumed from. It is stored
+ * in a file of little endian fields:
+ *     0  CHECKPOINT_MAGIC
+ *     8  uint32  number of layers
+ *     12 uint16  number of poles
+ *     14 uint16  reserved, always 0
+ *     16 uint128 number of moves made
+ *     32 uint64  checksum of the moves made
+ *     40 uint64  the masks of the poles, num_poles * num_words of them
+ */
+struct Checkpoint {
+    int num_layers;
+    int num_poles;
+    MoveCount num_moves;
+    unsigned long long checksum;
+    uint64_t *masks; // As in GameState
+};
+
+/*
+ * Writes checkpoints of a solve in the background. The solver hands over a
+ * checkpoint at most every interval seconds, skipping it if the writer is
+ * busy, and the writer thread replaces the file with it. Each checkpoint is
+ * written to a temporary file first and renamed over the last one, so that the
+ * file is always a whole checkpoint even if the process is killed.
+ */
+struct Checkpointer {
+    const char *filename;
+    char *temp_filename;
+    double interval; // Seconds between checkpoints
+    double next_time; // When the next checkpoint is due, only used by the solver
+    size_t size; // The size of each checkpoint
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t ready; // Signaled when there is a checkpoint to write or it is stopping
+    // Guarded by mutex
+    unsigned char *pending; // The latest checkpoint that has not been written
+    bool has_pending;
+    bool stopping;
+    unsigned char *writing; // The checkpoint being written, only used by the writer
+    // The first checkpoint that could not be written. The writer carries on
+    // since the solve itself is unaffected.
+    enum HanoiError error;
+    char error_message[ERROR_MESSAGE_MAX_LENGTH];
+};
+
+/*
+ * What the render thread does when the solver gets ahead of it
+ */
+enum RenderPolicy {
+    RENDER_BLOCK, // Draw every move, making the solver wait when the queue is full
+    RENDER_SKIP // Apply every queued move but only draw the last one
+};
+
+// Errors
+const char* get_error_message();
+
+// Time
+double get_time_seconds();
+
+// Files
+enum HanoiError map_file(const char *filename, struct MappedFile *file);
+void unmap_file(struct MappedFile *file);
+
+// Colors
+enum HanoiError load_colormap(const char *filename, struct ColorMap *colormap);
+void destroy_colormap(struct ColorMap colormap);
+struct ColorMap embedded_colormap();
+
+// Game state
+enum HanoiError initialize_game_state(struct GameState *game_state, int num_layers, int num_poles);
+enum HanoiError reset_game_state(struct GameState *game_state, int num_layers, int num_poles);
+void destroy_game_state(struct GameState *game_state);
+enum HanoiError set_state_at_move(struct GameState *game_state, unsigned long long move);
+enum HanoiError set_configuration(struct GameState *game_state, const int *poles);
+bool is_legal_move(struct GameState *game_state, int src, int dest);
+void move_disk(struct GameState *game_state, int src, int dest);
+bool same_poles(struct GameState a, struct GameState b);
+bool is_solved(struct GameState game_state);
+void format_move_count(char *dest, size_t size, MoveCount count);
+
+// Solving
+enum HanoiError initialize_split_table(struct SplitTable *table, int max_disks, int max_poles);
+void destroy_split_table(struct SplitTable *table);
+int split_index(struct SplitTable *table, int n, int p);
+MoveCount configuration_moves(struct GameState *game_state);
+enum HanoiError solve_hanoi(struct GameState *game_state, enum Engine engine, int num_threads);
+
+// Rendering
+enum HanoiError initialize_rendering(struct GameState *game_state, struct ColorMap colormap);
+void destroy_rendering(struct GameState *game_state);
+void set_frame_rate(struct GameState *game_state, int fps);
+void draw(struct GameState game_state);
+void redraw(struct GameState game_state);
+void finish_animation(struct GameState game_state);
+enum HanoiError solve_with_render_thread(struct GameState *game_state, enum Engine engine, int num_threads,
+                                         enum RenderPolicy policy, struct ColorMap colormap);
+
+// Move logs
+enum HanoiError open_move_log(struct MoveLog *log, const char *filename, enum MoveLogFormat format,
+                              struct GameState game_state);
+enum HanoiError close_move_log(struct MoveLog *log);
+enum HanoiError read_move_log_header(const unsigned char *data, size_t length, struct MoveLogHeader *header);
+unsigned long long check_moves(struct GameState *game_state, const unsigned char *moves, size_t num_bytes,
+                               unsigned long long num_moves, int bits_per_move);
+unsigned long long replay_moves(struct GameState *game_state, const unsigned char *moves, size_t num_bytes,
+                                unsigned long long num_moves, int bits_per_move);
+
+// Checkpoints
+enum HanoiError read_checkpoint(const char *filename, struct Checkpoint *checkpoint);
+void destroy_checkpoint(struct Checkpoint *checkpoint);
+enum HanoiError restore_checkpoint(struct GameState *game_state, struct Checkpoint checkpoint);
+enum HanoiError start_checkpointer(struct Checkpointer *checkpointer, const char *filename, int interval,
+                                   struct GameState *game_state);
+enum HanoiError stop_checkpointer(struct GameState *game_state);
+
+// Stats
+void print_stats(FILE *file, double elapsed, double startup_time);
+
+#endif
@@ -0,0 +1,707 @@
+/*
+ * Checks libhanoi against itself: every engine against the others, the states
+ * they pass through against seeking, the rejection of bad moves, the colormap
+ * parser against good and bad files, and the performance against its budgets.
+ * Run by make test.
+ */
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hanoi.h"
+
+#define DEFAULT_MAX_LAYERS 30 // The engines are checked for 1 up to this many layers by default
+#define VERIFY_STREAM_MAX_LAYERS 20 // Move streams are compared move by move up to this many layers
+#define VERIFY_SAMPLES 8 // The number of moves of each solve whose state is checked against seeking
+#define VERIFY_RESUME_MAX_LAYERS 20 // Solves are resumed from the sampled moves up to this many layers
+#define VERIFY_MAX_POLES 5 // The Frame-Stewart engine is checked with 4 up to this many poles
+#define VERIFY_CONFIGURATIONS 4 // The number of random pairs of configurations solved between per layer count
+#define VERIFY_SEARCH_MAX_LAYERS 6 // Up to this many layers, every pair of configurations is checked against a search
+// The budgets were recorded on an optimized build. The bytes per frame do not
+// depend on the machine, so they are always checked. The times do, with some
+// room left for slower machines, so they are only checked with --budgets.
+#define VERIFY_SOLVE_LAYERS 24
+#define VERIFY_SOLVE_NS_PER_MOVE 25.0 // Headless recursive solve, measured at 8.5
+#define VERIFY_RENDER_LAYERS 12
+#define VERIFY_RENDER_NS_PER_MOVE 2000.0 // Differential rendering to the null backend, measured at 210 to 440
+#define VERIFY_DIFFERENTIAL_BYTES_PER_FRAME 140.0 // Measured at 136.2
+#define VERIFY_FULL_BYTES_PER_FRAME 1660.0 // Measured at 1650.7
+
+/*
+ * The least number of moves for 1 up to CLOSED_FORM_MAX_LAYERS disks on 4 up
+ * to VERIFY_MAX_POLES poles, which the Frame-Stewart engine is checked against.
+ * Written out rather than computed so that they do not share a mistake with the
+ * split table. Optimal for 4 poles, as proven by Bousch, and the presumed
+ * optimum for 5 (OEIS A007664 and A007665).
+ */
+const unsigned long long frame_stewart_moves[VERIFY_MAX_POLES - DEFAULT_NUM_POLES][CLOSED_FORM_MAX_LAYERS] = {
+    {1, 3, 5, 9, 13, 17, 25, 33, 41, 49, 65, 81, 97, 113, 129, 161, 193, 225, 257, 289, 321, 385, 449, 513, 577,
+     641, 705, 769, 897, 1025, 1153, 1281, 1409, 1537, 1665, 1793, 2049, 2305, 2561, 2817, 3073, 3329, 3585, 3841,
+     4097, 4609, 5121, 5633, 6145, 6657, 7169, 7681, 8193, 8705, 9217, 10241, 11265, 12289, 13313, 14337, 15361,
+     16385, 17409},
+    {1, 3, 5, 7, 11, 15, 19, 23, 27, 31, 39, 47, 55, 63, 71, 79, 87, 95, 103, 111, 127, 143, 159, 175, 191, 207,
+     223, 239, 255, 271, 287, 303, 319, 335, 351, 383, 415, 447, 479, 511, 543, 575, 607, 639, 671, 703, 735, 767,
+     799, 831, 863, 895, 927, 959, 991, 1023, 1087, 1151, 1215, 1279, 1343, 1407, 1471}
+};
+
+/*
+ * Prints the message of error and exits if it is not HANOI_OK
+ */
+void exit_on_error(enum HanoiError error) {
+    if (error != HANOI_OK) {
+        fflush(stdout);
+        fprintf(stderr, "Error: %s\n", get_error_message());
+        exit(1);
+    }
+}
+
+/*
+ * Returns the number of online CPUs, or 1 if it cannot be determined
+ */
+int get_num_cpus() {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1) {
+        return 1;
+    }
+    return num_cpus > INT_MAX ? INT_MAX : (int) num_cpus;
+}
+
+/*
+ * The checks run so far
+ */
+struct Verification {
+    int num_checks;
+    int num_failed;
+    bool enforce_budgets; // Whether going over a time budget fails instead of only being reported
+};
+
+/*
+ * Prints one row of verification results and counts it. The detail is
+ * formatted like printf.
+ */
+void report_check(struct Verification *verification, const char *check, const char *variant, int num_layers,
+                  int num_poles, bool passed, const char *format, ...) {
+    verification->num_checks++;
+    if (!passed) {
+        verification->num_failed++;
+    }
+    printf("%s,%s,%d,%d,%s,\"", check, variant, num_layers, num_poles, passed ? "pass" : "fail");
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\"\n");
+    fflush(stdout);
+}
+
+/*
+ * What the move sink of a checked solve keeps track of. Each move
+ * is stored as src << 4 | dest, as in the move queue, or compared with the
+ * moves stored by an earlier solve. At each sampled move, the state is compared
+ * with the one set_state_at_move computes on seeked.
+ */
+struct VerifySink {
+    struct GameState *game_state; // The state being solved, set by verify_solve
+    unsigned char *moves; // The moves to store or compare with, or NULL
+    bool compare; // Whether moves are compared instead of stored
+    unsigned long long num_moves; // The number of moves seen
+    unsigned long long capacity; // The number of moves that fit in moves
+    unsigned long long mismatch; // The first move that differed, or 0 if none have
+    struct GameState *seeked; // Where the sampled states are seeked to, or NULL for no samples
+    const unsigned long long *samples; // The sorted moves to check the state after
+    unsigned long long *checksums; // The checksum after each sampled move
+    int num_samples;
+    int next_sample;
+    bool seek_failed; // Set if a sampled state did not match seeking to it
+    unsigned long long failed_sample;
+};
+
+/*
+ * Initializes a sink that does nothing until its moves or samples are set
+ */
+void initialize_verify_sink(struct VerifySink *sink) {
+    sink->moves = NULL;
+    sink->compare = false;
+    sink->num_moves = 0;
+    sink->capacity = 0;
+    sink->mismatch = 0;
+    sink->seeked = NULL;
+    sink->samples = NULL;
+    sink->checksums = NULL;
+    sink->num_samples = 0;
+    sink->next_sample = 0;
+    sink->seek_failed = false;
+    sink->failed_sample = 0;
+}
+
+/*
+ * Checks the state after the move just made if it is the next one sampled
+ */
+void check_sample(struct VerifySink *sink) {
+    while (sink->next_sample < sink->num_samples && sink->samples[sink->next_sample] == sink->num_moves) {
+        struct GameState *game_state = sink->game_state;
+        sink->checksums[sink->next_sample] = game_state->checksum;
+        if (!sink->seek_failed && (set_state_at_move(sink->seeked, sink->num_moves) != HANOI_OK ||
+                                   !same_poles(*sink->seeked, *game_state))) {
+            sink->seek_failed = true;
+            sink->failed_sample = sink->num_moves;
+        }
+        sink->next_sample++;
+    }
+}
+
+/*
+ * Move sink for the checks. Stops the solve at the first move that differs from
+ * the stored ones.
+ */
+bool verify_move(void *context, int src, int dest) {
+    struct VerifySink *sink = context;
+    unsigned char move = src << 4 | dest;
+    if (sink->moves != NULL) {
+        if (sink->num_moves >= sink->capacity) {
+            sink->mismatch = sink->num_moves + 1;
+        } else if (!sink->compare) {
+            sink->moves[sink->num_moves] = move;
+        } else if (sink->moves[sink->num_moves] != move) {
+            sink->mismatch = sink->num_moves + 1;
+        }
+    }
+    sink->num_moves++;
+    if (sink->seeked != NULL) {
+        check_sample(sink);
+    }
+    return sink->mismatch == 0;
+}
+
+/*
+ * The outcome of a checked solve
+ */
+struct VerifyResult {
+    enum HanoiError error;
+    char error_message[ERROR_MESSAGE_MAX_LENGTH];
+    MoveCount num_moves;
+    MoveCount total_moves; // The number of moves the solve should take
+    unsigned long long checksum;
+    bool solved;
+    double seconds;
+};
+
+/*
+ * Solves num_layers layers on num_poles poles headless with engine, passing the
+ * moves to sink if it is not NULL. The solve starts after seek moves, or from
+ * initial if it is not NULL, and ends at goal if it is not NULL.
+ */
+struct VerifyResult verify_solve(int num_layers, int num_poles, enum Engine engine, int num_threads,
+                                 struct SplitTable *split_table, unsigned long long seek, const int *initial,
+                                 const int *goal, struct VerifySink *sink) {
+    struct VerifyResult result;
+    result.num_moves = 0;
+    result.total_moves = 0;
+    result.checksum = 0;
+    result.solved = false;
+    result.seconds = 0;
+    struct GameState game_state;
+    result.error = initialize_game_state(&game_state, num_layers, num_poles);
+    bool initialized = result.error == HANOI_OK;
+    if (initialized) {
+        game_state.headless = true;
+        game_state.split_table = split_table;
+        game_state.goal = goal;
+        result.total_moves = game_state.total_moves;
+        if (seek > 0) {
+            result.error = set_state_at_move(&game_state, seek);
+        } else if (initial != NULL) {
+            result.error = set_configuration(&game_state, initial);
+        }
+        if (engine == ENGINE_CONFIGURATION) {
+            result.total_moves = configuration_moves(&game_state) + game_state.num_moves;
+        }
+    }
+    if (result.error == HANOI_OK) {
+        if (sink != NULL) {
+            sink->game_state = &game_state;
+            game_state.move_sink = verify_move;
+            game_state.move_sink_context = sink;
+        }
+        double start = get_time_seconds();
+        result.error = solve_hanoi(&game_state, engine, num_threads);
+        result.seconds = get_time_seconds() - start;
+        result.num_moves = game_state.num_moves;
+        result.checksum = game_state.checksum;
+        result.solved = is_solved(game_state);
+    }
+    if (result.error != HANOI_OK) {
+        snprintf(result.error_message, sizeof(result.error_message), "%s", get_error_message());
+    }
+    if (initialized) {
+        destroy_game_state(&game_state);
+    }
+    return result;
+}
+
+/*
+ * Returns the nth of a fixed sequence of pseudorandom numbers, the splitmix64
+ * generator, for picking the moves and configurations that are checked
+ */
+unsigned long long verify_random(unsigned long long n) {
+    unsigned long long z = (n + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * Checks a solve against the expected number of moves and, if reference is not
+ * NULL, its checksum. A sink comparing moves is checked for the first that
+ * differed.
+ */
+void check_solve(struct Verification *verification, const char *check, const char *variant, int num_layers,
+                 int num_poles, struct VerifyResult result, const struct VerifyResult *reference,
+                 const struct VerifySink *sink) {
+    char moves[MOVE_COUNT_MAX_DIGITS + 1], expected[MOVE_COUNT_MAX_DIGITS + 1];
+    format_move_count(moves, sizeof(moves), result.num_moves);
+    format_move_count(expected, sizeof(expected), result.total_moves);
+    if (result.error != HANOI_OK && !(sink != NULL && sink->mismatch != 0)) {
+        report_check(verification, check, variant, num_layers, num_poles, false, "%s", result.error_message);
+    } else if (sink != NULL && sink->mismatch != 0) {
+        report_check(verification, check, variant, num_layers, num_poles, false, "move %llu differs",
+                     sink->mismatch);
+    } else if (result.num_moves != result.total_moves || !result.solved) {
+        report_check(verification, check, variant, num_layers, num_poles, false, "%s moves instead of %s, %s",
+                     moves, expected, result.solved ? "solved" : "not solved");
+    } else if (reference != NULL && result.checksum != reference->checksum) {
+        report_check(verification, check, variant, num_layers, num_poles, false,
+                     "checksum %016llx instead of %016llx", result.checksum, reference->checksum);
+    } else {
+        report_check(verification, check, variant, num_layers, num_poles, true, "%s moves, checksum %016llx",
+                     moves, result.checksum);
+    }
+}
+
+/*
+ * Checks every engine that can solve num_layers layers on 3 poles against the
+ * recursive engine: the number of moves and checksum, and the moves themselves
+ * if there are few enough to store. The states the recursive engine passes
+ * through are checked against seeking at sampled moves, and solves resumed
+ * from those states against the rest of the recursive solve.
+ */
+void verify_engines(struct Verification *verification, int num_layers, int num_threads) {
+    MoveCount total_moves = ((MoveCount) 1 << num_layers) - 1;
+    struct VerifySink sink;
+    initialize_verify_sink(&sink);
+    unsigned char *moves = NULL;
+    if (num_layers <= VERIFY_STREAM_MAX_LAYERS) {
+        moves = malloc(total_moves);
+        if (moves == NULL) {
+            fprintf(stderr, "Error: out of memory for %d layers of moves\n", num_layers);
+            exit(1);
+        }
+        sink.moves = moves;
+        sink.capacity = total_moves;
+    }
+    // The first and last moves are always sampled, and the rest are sorted
+    unsigned long long samples[VERIFY_SAMPLES];
+    unsigned long long checksums[VERIFY_SAMPLES];
+    samples[0] = 1;
+    samples[VERIFY_SAMPLES - 1] = total_moves;
+    for (int i = 1; i < VERIFY_SAMPLES - 1; i++) {
+        samples[i] = 1 + verify_random((unsigned long long) num_layers * VERIFY_SAMPLES + i) % total_moves;
+    }
+    for (int i = 1; i < VERIFY_SAMPLES; i++) {
+        for (int j = i; j > 0 && samples[j - 1] > samples[j]; j--) {
+            unsigned long long swap = samples[j];
+            samples[j] = samples[j - 1];
+            samples[j - 1] = swap;
+        }
+    }
+    struct GameState seeked;
+    exit_on_error(initialize_game_state(&seeked, num_layers, DEFAULT_NUM_POLES));
+    sink.seeked = &seeked;
+    sink.samples = samples;
+    sink.checksums = checksums;
+    sink.num_samples = VERIFY_SAMPLES;
+
+    struct VerifyResult reference = verify_solve(num_layers, DEFAULT_NUM_POLES, ENGINE_RECURSIVE, 1, NULL, 0, NULL,
+                                                 NULL, &sink);
+    check_solve(verification, "engine", "recursive", num_layers, DEFAULT_NUM_POLES, reference, NULL, NULL);
+    if (sink.seek_failed) {
+        report_check(verification, "seek", "state", num_layers, DEFAULT_NUM_POLES, false,
+                     "the state after move %llu differs", sink.failed_sample);
+    } else {
+        report_check(verification, "seek", "state", num_layers, DEFAULT_NUM_POLES, sink.next_sample == VERIFY_SAMPLES,
+                     "%d of %d sampled states match", sink.next_sample, VERIFY_SAMPLES);
+    }
+    destroy_game_state(&seeked);
+
+    int goal[CLOSED_FORM_MAX_LAYERS];
+    for (int i = 0; i < num_layers; i++) {
+        goal[i] = DEFAULT_NUM_POLES - 1;
+    }
+    struct SplitTable split_table;
+    exit_on_error(initialize_split_table(&split_table, num_layers, DEFAULT_NUM_POLES));
+    static const struct {
+        const char *name;
+        enum Engine engine;
+    } engines[] = {
+        {"iterative", ENGINE_ITERATIVE},
+        {"parallel", ENGINE_PARALLEL},
+        {"frame-stewart", ENGINE_FRAME_STEWART},
+        {"configuration", ENGINE_CONFIGURATION}
+    };
+    for (size_t i = 0; i < sizeof(engines) / sizeof(*engines); i++) {
+        // The parallel engine cannot pass moves to a sink
+        bool compare = moves != NULL && engines[i].engine != ENGINE_PARALLEL;
+        initialize_verify_sink(&sink);
+        sink.moves = moves;
+        sink.capacity = total_moves;
+        sink.compare = true;
+        struct VerifyResult result = verify_solve(num_layers, DEFAULT_NUM_POLES, engines[i].engine, num_threads,
+                                                  &split_table, 0, NULL, goal, compare ? &sink : NULL);
+        check_solve(verification, "engine", engines[i].name, num_layers, DEFAULT_NUM_POLES, result, &reference,
+                    compare ? &sink : NULL);
+    }
+    destroy_split_table(&split_table);
+
+    if (num_layers <= VERIFY_RESUME_MAX_LAYERS) {
+        static const struct {
+            const char *name;
+            enum Engine engine;
+        } resumers[] = {
+            {"recursive", ENGINE_RECURSIVE},
+            {"iterative", ENGINE_ITERATIVE},
+            {"configuration", ENGINE_CONFIGURATION}
+        };
+        for (size_t i = 0; i < sizeof(resumers) / sizeof(*resumers); i++) {
+            bool passed = true;
+            for (int j = 0; j < VERIFY_SAMPLES && passed; j++) {
+                struct VerifyResult result = verify_solve(num_layers, DEFAULT_NUM_POLES, resumers[i].engine, 1, NULL,
+                                                          samples[j], NULL, goal, NULL);
+                // The rest of the moves make up the rest of the checksum
+                result.checksum += checksums[j];
+                passed = result.error == HANOI_OK && result.num_moves == total_moves && result.solved &&
+                         result.checksum == reference.checksum;
+                if (!passed) {
+                    check_solve(verification, "resume", resumers[i].name, num_layers, DEFAULT_NUM_POLES, result,
+                                &reference, NULL);
+                }
+            }
+            if (passed) {
+                report_check(verification, "resume", resumers[i].name, num_layers, DEFAULT_NUM_POLES, true,
+                             "resumed from %d sampled moves", VERIFY_SAMPLES);
+            }
+        }
+    }
+    free(moves);
+}
+
+/*
+ * Fills distances with the least number of moves from configuration from to
+ * each of the 3^num_layers configurations on 3 poles, by a breadth first search
+ * over legal moves. Configuration c puts disk i, counting from the smallest, on
+ * pole c / 3^i % 3. queue must hold as many configurations as distances. This
+ * shares nothing with the configuration engine, so that it can check it.
+ */
+void search_configurations(int num_layers, int from, int *distances, int *queue) {
+    int num_configurations = 1;
+    for (int i = 0; i < num_layers; i++) {
+        num_configurations *= DEFAULT_NUM_POLES;
+    }
+    for (int c = 0; c < num_configurations; c++) {
+        distances[c] = -1;
+    }
+    distances[from] = 0;
+    queue[0] = from;
+    int head = 0, tail = 1;
+    while (head < tail) {
+        int c = queue[head++];
+        // The top disk of each pole is the smallest on it, so go from the largest down
+        int tops[DEFAULT_NUM_POLES] = {num_layers, num_layers, num_layers};
+        int weights[DEFAULT_NUM_POLES];
+        for (int i = num_layers - 1, rest = c, weight = num_configurations / DEFAULT_NUM_POLES; i >= 0;
+                i--, weight /= DEFAULT_NUM_POLES) {
+            tops[rest / weight] = i;
+            weights[rest / weight] = weight;
+            rest %= weight;
+        }
+        for (int src = 0; src < DEFAULT_NUM_POLES; src++) {
+            for (int dest = 0; dest < DEFAULT_NUM_POLES; dest++) {
+                if (src == dest || tops[src] >= tops[dest]) {
+                    continue;
+                }
+                int next = c + (dest - src) * weights[src];
+                if (distances[next] == -1) {
+                    distances[next] = distances[c] + 1;
+                    queue[tail++] = next;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Writes configuration c, numbered as in search_configurations, to poles and
+ * as the pole of each disk from the largest to the smallest, as given to
+ * --initial, to str, which must hold num_layers + 1 characters
+ */
+void decode_configuration(int num_layers, int c, int *poles, char *str) {
+    for (int i = 0; i < num_layers; i++, c /= DEFAULT_NUM_POLES) {
+        poles[i] = c % DEFAULT_NUM_POLES;
+        str[num_layers - 1 - i] = '0' + poles[i];
+    }
+    str[num_layers] = '\0';
+}
+
+/*
+ * Checks the configuration engine between every pair of configurations of
+ * num_layers layers against search_configurations, reporting the first pair
+ * that is not solved in the least number of moves
+ */
+void verify_all_configurations(struct Verification *verification, int num_layers) {
+    int num_configurations = 1;
+    for (int i = 0; i < num_layers; i++) {
+        num_configurations *= DEFAULT_NUM_POLES;
+    }
+    int *distances = malloc(2 * num_configurations * sizeof(*distances));
+    if (distances == NULL) {
+        fprintf(stderr, "Error: out of memory searching configurations\n");
+        exit(1);
+    }
+    int *queue = distances + num_configurations;
+    for (int from = 0; from < num_configurations; from++) {
+        search_configurations(num_layers, from, distances, queue);
+        int initial[VERIFY_SEARCH_MAX_LAYERS], goal[VERIFY_SEARCH_MAX_LAYERS];
+        char initial_str[VERIFY_SEARCH_MAX_LAYERS + 1], goal_str[VERIFY_SEARCH_MAX_LAYERS + 1];
+        decode_configuration(num_layers, from, initial, initial_str);
+        for (int to = 0; to < num_configurations; to++) {
+            decode_configuration(num_layers, to, goal, goal_str);
+            struct VerifyResult result = verify_solve(num_layers, DEFAULT_NUM_POLES, ENGINE_CONFIGURATION, 1, NULL,
+                                                      0, initial, goal, NULL);
+            if (result.error != HANOI_OK || !result.solved || result.num_moves != (MoveCount) distances[to] ||
+                    result.total_moves != (MoveCount) distances[to]) {
+                char moves[MOVE_COUNT_MAX_DIGITS + 1], expected[MOVE_COUNT_MAX_DIGITS + 1];
+                format_move_count(moves, sizeof(moves), result.num_moves);
+                format_move_count(expected, sizeof(expected), result.total_moves);
+                report_check(verification, "configuration", "all-pairs", num_layers, DEFAULT_NUM_POLES, false,
+                             "%s to %s: %s moves, %s expected and %d least, %s", initial_str, goal_str, moves,
+                             expected, distances[to], result.error != HANOI_OK ? result.error_message :
+                             result.solved ? "solved" : "not solved");
+                free(distances);
+                return;
+            }
+        }
+    }
+    report_check(verification, "configuration", "all-pairs", num_layers, DEFAULT_NUM_POLES, true,
+                 "%d pairs in the least number of moves", num_configurations * num_configurations);
+    free(distances);
+}
+
+/*
+ * Checks the Frame-Stewart engine on 4 up to VERIFY_MAX_POLES poles against
+ * frame_stewart_moves, and the configuration engine between every pair of
+ * configurations against a search, or above VERIFY_SEARCH_MAX_LAYERS layers
+ * between pseudorandom pairs, where it is only checked to solve in the number
+ * of moves it expects
+ */
+void verify_other_engines(struct Verification *verification, int num_layers, struct SplitTable *split_table) {
+    for (int p = DEFAULT_NUM_POLES + 1; p <= VERIFY_MAX_POLES; p++) {
+        struct VerifyResult result = verify_solve(num_layers, p, ENGINE_FRAME_STEWART, 1, split_table, 0, NULL,
+                                                  NULL, NULL);
+        result.total_moves = frame_stewart_moves[p - DEFAULT_NUM_POLES - 1][num_layers - 1];
+        check_solve(verification, "engine", "frame-stewart", num_layers, p, result, NULL, NULL);
+    }
+    if (num_layers <= VERIFY_SEARCH_MAX_LAYERS) {
+        verify_all_configurations(verification, num_layers);
+        return;
+    }
+    for (int i = 0; i < VERIFY_CONFIGURATIONS; i++) {
+        int initial[CLOSED_FORM_MAX_LAYERS], goal[CLOSED_FORM_MAX_LAYERS];
+        unsigned long long seed = ((unsigned long long) num_layers * VERIFY_CONFIGURATIONS + i) * 2 *
+                                  CLOSED_FORM_MAX_LAYERS;
+        for (int j = 0; j < num_layers; j++) {
+            // One draw per disk, where the bias of reducing 64 bits modulo 3 is negligible
+            initial[j] = verify_random(seed + j) % DEFAULT_NUM_POLES;
+            goal[j] = verify_random(seed + CLOSED_FORM_MAX_LAYERS + j) % DEFAULT_NUM_POLES;
+        }
+        struct VerifyResult result = verify_solve(num_layers, DEFAULT_NUM_POLES, ENGINE_CONFIGURATION, 1, NULL, 0,
+                                                  initial, goal, NULL);
+        check_solve(verification, "configuration", "random", num_layers, DEFAULT_NUM_POLES, result, NULL, NULL);
+    }
+}
+
+/*
+ * Checks a measurement against its budget. A time is only reported, as within
+ * or over the budget, unless budgets are enforced.
+ */
+void check_budget(struct Verification *verification, const char *variant, int num_layers, double value,
+                  double budget, bool timed) {
+    if (!timed || verification->enforce_budgets) {
+        report_check(verification, "budget", variant, num_layers, DEFAULT_NUM_POLES, value <= budget,
+                     "%.1f <= %.1f", value, budget);
+        return;
+    }
+    printf("budget,%s,%d,%d,%s,\"%.1f <= %.1f\"\n", variant, num_layers, DEFAULT_NUM_POLES,
+           value <= budget ? "within" : "over", value, budget);
+    fflush(stdout);
+}
+
+/*
+ * Checks the time per move of a headless solve and of rendering, and the bytes
+ * per frame of each renderer, against the budgets they were recorded with
+ */
+void verify_budgets(struct Verification *verification) {
+    struct VerifyResult solve = verify_solve(VERIFY_SOLVE_LAYERS, DEFAULT_NUM_POLES, ENGINE_RECURSIVE, 1, NULL, 0,
+                                             NULL, NULL, NULL);
+    exit_on_error(solve.error);
+    check_budget(verification, "solve-ns-per-move", VERIFY_SOLVE_LAYERS,
+                 solve.seconds * S_TO_NS_MULTIPLIER / solve.num_moves, VERIFY_SOLVE_NS_PER_MOVE, true);
+
+    for (int full = 0; full <= 1; full++) {
+        struct GameState game_state;
+        exit_on_error(initialize_game_state(&game_state, VERIFY_RENDER_LAYERS, DEFAULT_NUM_POLES));
+        game_state.backend = BACKEND_NULL;
+        game_state.differential = !full;
+        game_state.delay_ms = 0;
+        exit_on_error(initialize_rendering(&game_state, embedded_colormap()));
+        double start = get_time_seconds();
+        draw(game_state);
+        exit_on_error(solve_hanoi(&game_state, ENGINE_RECURSIVE, 1));
+        double seconds = get_time_seconds() - start;
+        double bytes_per_frame = (double) game_state.frame_buffer->bytes_written / game_state.frame_buffer->num_flushes;
+        if (full) {
+            check_budget(verification, "full-bytes-per-frame", VERIFY_RENDER_LAYERS, bytes_per_frame,
+                         VERIFY_FULL_BYTES_PER_FRAME, false);
+        } else {
+            check_budget(verification, "render-ns-per-move", VERIFY_RENDER_LAYERS,
+                         seconds * S_TO_NS_MULTIPLIER / (double) game_state.num_moves, VERIFY_RENDER_NS_PER_MOVE, true);
+            check_budget(verification, "differential-bytes-per-frame", VERIFY_RENDER_LAYERS, bytes_per_frame,
+                         VERIFY_DIFFERENTIAL_BYTES_PER_FRAME, false);
+        }
+        destroy_rendering(&game_state);
+        destroy_game_state(&game_state);
+    }
+}
+
+/*
+ * Checks that is_legal_move and move_disk reject a move from src to dest on 3
+ * layers with the expected error, leaving the state as it was
+ */
+void check_rejected_move(struct Verification *verification, const char *variant, int src, int dest,
+                         enum HanoiError expected) {
+    struct GameState game_state;
+    exit_on_error(initialize_game_state(&game_state, 3, DEFAULT_NUM_POLES));
+    game_state.headless = true;
+    bool legal = is_legal_move(&game_state, src, dest);
+    move_disk(&game_state, src, dest);
+    bool passed = !legal && game_state.error == expected && game_state.num_moves == 0 && game_state.checksum == 0;
+    report_check(verification, "move", variant, 3, DEFAULT_NUM_POLES, passed, "%s",
+                 game_state.error != HANOI_OK ? get_error_message() : "accepted");
+    destroy_game_state(&game_state);
+}
+
+/*
+ * Checks that moves between poles that do not exist, or from a pole to
+ * itself, are rejected
+ */
+void verify_rejected_moves(struct Verification *verification) {
+    check_rejected_move(verification, "negative-src", -1, 1, HANOI_ERROR_INVALID_ARGUMENT);
+    check_rejected_move(verification, "missing-dest", 0, DEFAULT_NUM_POLES, HANOI_ERROR_INVALID_ARGUMENT);
+    check_rejected_move(verification, "same-pole", 0, 0, HANOI_ERROR_ILLEGAL_MOVE);
+}
+
+/*
+ * Writes contents to a temporary file and checks that load_colormap gives
+ * expected for it, and the expected number of colors if it succeeds
+ */
+void check_colormap(struct Verification *verification, const char *variant, const char *contents,
+                    enum HanoiError expected, int expected_length) {
+    char filename[] = "/tmp/test-hanoi-XXXXXX";
+    int fd = mkstemp(filename);
+    FILE *file = fd == -1 ? NULL : fdopen(fd, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: cannot create a temporary colormap\n");
+        exit(1);
+    }
+    fputs(contents, file);
+    fclose(file);
+    struct ColorMap colormap;
+    enum HanoiError error = load_colormap(filename, &colormap);
+    remove(filename);
+    if (error == HANOI_OK) {
+        bool passed = expected == HANOI_OK && colormap.length == expected_length;
+        report_check(verification, "colormap", variant, 0, 0, passed, "%d colors", colormap.length);
+        destroy_colormap(colormap);
+    } else {
+        report_check(verification, "colormap", variant, 0, 0, error == expected, "%s", get_error_message());
+    }
+}
+
+/*
+ * Checks loading colormaps with each line ending, and rejecting records that do
+ * not each end their line
+ */
+void verify_colormaps(struct Verification *verification) {
+    check_colormap(verification, "lf", "0,0,0\n1,1,1\n2,2,2\n", HANOI_OK, 3);
+    check_colormap(verification, "crlf", "0,0,0\r\n1,1,1\r\n2,2,2", HANOI_OK, 3);
+    check_colormap(verification, "one-line", "0,0,0 1,1,1 2,2,2 3,3,3", HANOI_ERROR_INVALID_FILE, 0);
+    check_colormap(verification, "cr", "0,0,0\r1,1,1\r2,2,2\r3,3,3\r", HANOI_ERROR_INVALID_FILE, 0);
+}
+
+/*
+ * Cross-checks every engine for 1 up to max_layers layers and the performance
+ * against its budgets, printing a CSV row for each check. Returns the exit
+ * status, which is 1 if any check failed.
+ */
+int run_verification(int max_layers, int num_threads, bool enforce_budgets) {
+    struct Verification verification;
+    verification.num_checks = 0;
+    verification.num_failed = 0;
+    verification.enforce_budgets = enforce_budgets;
+    struct SplitTable split_table;
+    exit_on_error(initialize_split_table(&split_table, max_layers, VERIFY_MAX_POLES));
+
+    printf("check,variant,num_layers,num_poles,result,detail\n");
+    for (int n = 1; n <= max_layers; n++) {
+        verify_engines(&verification, n, num_threads);
+        verify_other_engines(&verification, n, &split_table);
+    }
+    verify_rejected_moves(&verification);
+    verify_colormaps(&verification);
+    verify_budgets(&verification);
+    destroy_split_table(&split_table);
+    if (verification.num_failed > 0) {
+        fprintf(stderr, "Error: %d of %d checks failed\n", verification.num_failed, verification.num_checks);
+        return 1;
+    }
+    return 0;
+}
+
+
+void print_usage(const char *program) {
+    printf("Usage: %s [--budgets] [max_layers]\n", program);
+    printf("Checks every engine for 1 to max_layers layers (default %d, at most %d) and prints\n",
+           DEFAULT_MAX_LAYERS, CLOSED_FORM_MAX_LAYERS);
+    printf("a CSV row per check. The times against their budgets are only reported unless\n");
+    printf("--budgets is given.\n");
+}
+
+int main(int argc, char* argv[]) {
+    int max_layers = DEFAULT_MAX_LAYERS;
+    bool enforce_budgets = false;
+    for (int i = 1; i < argc; i++) {
+        char *end;
+        long n = strtol(argv[i], &end, 10);
+        if (strcmp(argv[i], "--budgets") == 0) {
+            enforce_budgets = true;
+        } else if (*argv[i] != '\0' && *end == '\0' && n >= 1 && n <= CLOSED_FORM_MAX_LAYERS) {
+            max_layers = (int) n;
+        } else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    return run_verification(max_layers, get_num_cpus(), enforce_budgets);
+}
@@ -1,499 +1,1346 @@
+#include <errno.h>
+#include <getopt.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
+#include <unistd.h>
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/resource.h>
 #endif
 
-// Strings used for rendering
-#define EMPTY " "
-#define DISK "█"
-#define ROD "│"
+#include "hanoi.h"
 
-#define NUM_POLES 3
-#define SPACE_BETWEEN_POLES 3 // The number of empty spaces between poles when rendering
-#define ANIMATION_DELAY_MS 200 // Delay between animation draws in milliseconds
-#define MS_TO_NS_MULTIPLIER 1000000 // 1 millisecond = 1,000,000 nanoseconds
-#define S_TO_MS_MULTIPLIER 1000 // 1 seconds = 1,000 milliseconds
+#define COLORMAP_FILE "CET-I1.csv" // The csv file the built in colormap is generated from
 
-#define ARRAY_RESIZE_INCREMENT 256; // For dynamic array allocation
-#define COLORMAP_FILE "CET-I1.csv" // The csv file containing the colormap used
+// stdout is fully buffered with a buffer of this size, and flushed once per frame
+#define STDOUT_BUFFER_SIZE (1 << 16)
+#define BATCH_LINE_MAX_LENGTH 256 // Lines of a batch file longer than this are rejected
 
+// Used by --bench
+#define BENCH_MIN_TIME_S 0.2 // Each measurement is repeated until it has run for this long
+#define BENCH_COLORMAP_LOADS 100 // The number of times the colormap is loaded per measurement
 
 /*
- * Stores an rgb value as a triplet of bytes
+ * Takes a string representing the number of layers for the Tower of Hanoi
+ * and converts it to an int while doing error and bounds checking.
+ * If the string is invalid, it prints an error message and returns -1.
+ * Returns the number of layers, or -1 on error
  */
-struct Color {
-    int r, g, b;
-};
+int string_to_num_layers(char arg[]) {
+    char* str_end;
+    long n = strtol(arg, &str_end, 10);
+    if (n == LONG_MIN || n == LONG_MAX) {
+        perror("Error: Invalid num_layers");
+        return -1;
+    }
+    if (*str_end != '\0') {
+        fprintf(stderr, "Error: num_layers must be an integer\n");
+        return -1;
+    }
+    if (n <= 0) {
+        fprintf(stderr, "Error: num_layers greater than zero\n");
+        return -1;
+    }
+    if (n > INT_MAX) {
+        fprintf(stderr, "Error: num_layers must be less than %d\n", INT_MAX);
+        return -1;
+    }
+    return (int) n;
+}
 
 /*
- * Stores a color map for converting from a scalar to a color.
- * It is stored as an array where each color is equally spaced. THe length is
- * the number of color values.
+ * Takes a string representing the value of a command line option and converts
+ * it to an int in the range [min, max]. name is used in error messages.
+ * Returns true on success, or prints an error message and returns false.
  */
-struct ColorMap {
-    struct Color *colors;
-    int length;
-};
+bool string_to_option(const char arg[], const char name[], int min, int max, int *value) {
+    char* str_end;
+    errno = 0;
+    long n = strtol(arg, &str_end, 10);
+    if (errno != 0 || str_end == arg || *str_end != '\0') {
+        fprintf(stderr, "Error: %s must be an integer\n", name);
+        return false;
+    }
+    if (n < min || n > max) {
+        fprintf(stderr, "Error: %s must be between %d and %d\n", name, min, max);
+        return false;
+    }
+    *value = (int) n;
+    return true;
+}
 
 /*
- * Stores information about a single disk
+ * Takes a string representing a move number and converts it to an unsigned
+ * long long. Returns true on success, or prints an error message and returns
+ * false.
  */
-struct Disk {
-    int size; // The size of the disk
-    struct Color color; // The color of the disk
-};
+bool string_to_move(const char arg[], unsigned long long *move) {
+    char* str_end;
+    errno = 0;
+    // strtoull accepts a leading minus sign, which is not a valid move
+    if (strchr(arg, '-') != NULL) {
+        fprintf(stderr, "Error: move must not be negative\n");
+        return false;
+    }
+    unsigned long long n = strtoull(arg, &str_end, 10);
+    if (errno != 0 || str_end == arg || *str_end != '\0') {
+        fprintf(stderr, "Error: move must be an integer\n");
+        return false;
+    }
+    *move = n;
+    return true;
+}
 
 /*
- * Stores information about a single pole
+ * Takes a string of one pole, 0, 1 or 2, per disk from the largest to the
+ * smallest and converts it to the pole of each disk counting from the smallest.
+ * Returns the number of disks, or prints an error message and returns -1.
  */
-struct Pole {
-    int size; // The max size of the pole
-    int num_disk; // The current number of disks on the pole
-    struct Disk *disks; // Array storing the disk with lower ones closer to bottom.
-};
+int string_to_configuration(const char arg[], const char name[], int poles[]) {
+    int num_layers = strlen(arg);
+    if (num_layers == 0 || num_layers > CLOSED_FORM_MAX_LAYERS) {
+        fprintf(stderr, "Error: %s must have between 1 and %d disks\n", name, CLOSED_FORM_MAX_LAYERS);
+        return -1;
+    }
+    for (int i = 0; i < num_layers; i++) {
+        char pole = arg[num_layers - 1 - i];
+        if (pole < '0' || pole > '2') {
+            fprintf(stderr, "Error: %s must be made of the poles 0, 1 and 2\n", name);
+            return -1;
+        }
+        poles[i] = pole - '0';
+    }
+    return num_layers;
+}
 
 /*
- * Stores information about the overall state of the game
+ * Asks the user enter the number of layers and returns it. Repeats if the user
+ * gives an invalid input.
+ * 
+ * Returns the number of layers, or -1 on error
  */
-struct GameState {
-    struct Pole *poles; // Points to array of poles
-    int num_layers; // The total number of layers
-    // Tracks the number of moves made so far
-    // It is a long due to the exponential growth of the number of moves.
-    long num_moves; 
-};
+int get_num_layers_from_user() {
+    int buf_size = 64;
+    char buf[buf_size];
+    while(true) {
+        printf("Enter the number of layers: ");
+        fflush(stdout);
+        if (fgets(buf, buf_size, stdin) == NULL) {
+            // Read failed or reached end of file
+            if (ferror(stdin)) {
+                perror("Error");
+            }
+            return -1;
+        }
+        // Strip trailing newline if necessary
+        int length = strlen(buf);
+        if (length > 0 && buf[length - 1] == '\n') {
+            buf[length -1] = '\0';
+        }
+        if (buf[0] == '\0') {
+            // Skip empty lines
+            continue;
+        }
+        int num_layers = string_to_num_layers(buf);
+        if (num_layers == -1) {
+            // Failed to convert to int
+            continue;
+        }
+        return num_layers;
+    }
+}
 
+#ifdef _WIN32
 /*
- * Attempts to malloc size bytes, exits on failure
+ * Windows shells do not enable virtual terminal by default so this is necessary
+ * to ensure that the colors are printed correctly.
  */
-void* malloc_or_die(size_t size) {
-    void *ptr = malloc(size);
-    if(ptr == NULL) {
-        perror("malloc failed");
-        exit(1);
+void enable_virtual_terminal_windows() {
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode;
+    if (!GetConsoleMode(out, mode)) {
+        printf("Error enabling enabling virtual terminal\n");
+        return;
+    }
+    if (!SetConsoleMode(out, mode | ENABLE_PROCESSED_OUTPUT | ENABLE_VIRTUAL_TERMINAL_PROCESSING)) {
+        printf("Error enabling enabling virtual terminal\n");
+        return;
     }
-    return ptr;
 }
+#endif
 
 /*
- * Reads in a csv file containing the ColorMap. The file must contain three
- * columns representing red, green and blue in that order. Each row defines a color
- * as a triplet of numbers from 0-255 progressing from the lowest to highest
- * color. The colors are assumed to be equally spaced. There can be any number
- * of colors included.
- *
- * In the event of failure, may print an error and returns a colormap where
- * colormap.colors is not allocated and length is set to -1.
+ * Returns the number of online CPUs, or 1 if it cannot be determined
  */
-struct ColorMap load_colormap(const char *filename) {
-    struct ColorMap cmap;
-    int arraysize = ARRAY_RESIZE_INCREMENT;
-    int r, g, b;
+int get_num_cpus() {
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1) {
+        return 1;
+    }
+    return num_cpus > INT_MAX ? INT_MAX : (int) num_cpus;
+}
 
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        perror("Error");
-        cmap.length = -1;
-        return cmap;
-    }
-    // Begin reading
-    cmap.colors = malloc_or_die(arraysize * sizeof(*cmap.colors));
-    int i = 0;
-    while(1) {
-        int n = fscanf(file, "%d,%d,%d\n", &r, &g, &b);
-        // Check for end of file or invalid format
-        if (n == EOF && !ferror(file)) {
+/*
+ * Stores the options given on the command line
+ */
+struct Options {
+    int num_layers; // -1 if it should be asked for
+    int delay_ms;
+    int fps; // The target frame rate, or 0 to draw every move
+    bool headless;
+    enum Engine engine;
+    bool seek; // Whether to start from seek_move instead of the beginning
+    unsigned long long seek_move;
+    int num_threads; // The number of threads used by the parallel engine or to run the jobs of a batch
+    bool threads_given; // Whether the number of threads was chosen instead of left as the default
+    int num_poles;
+    bool engine_given; // Whether the engine was chosen instead of left as the default
+    const char *output; // The file moves are written to instead of rendered, or NULL
+    enum MoveLogFormat output_format;
+    const char *replay; // The binary move log to replay instead of solving, or NULL
+    bool bench; // Whether to run the benchmarks instead of solving
+    bool stats; // Whether to print the counters in Stats at exit
+    bool render_thread; // Whether to render on a separate thread from the solver
+    enum RenderPolicy render_policy;
+    enum ColorMode color_mode;
+    enum Backend backend; // Where frames go
+    bool full_redraw; // Whether the terminal is redrawn in full every frame instead of differentially
+    enum ViewportMode viewport; // How to draw towers too large for the terminal
+    const char *colormap; // The csv file colors are loaded from, or NULL for the built in colormap
+    const char *checkpoint; // The file to save checkpoints to, or NULL
+    int checkpoint_interval; // Seconds between checkpoints
+    const char *resume; // The checkpoint to continue from, or NULL
+    const char *batch; // The file of jobs to run instead of solving once, - for stdin, or NULL
+    // The configurations to solve between with the configuration engine, or NULL
+    // for every disk on the first and last pole
+    const char *initial;
+    const char *goal;
+};
+
+void print_usage(const char *program) {
+    printf("Usage: %s [options] [num_layers]\n", program);
+    printf("Options:\n");
+    printf("    -d, --delay MS    Delay between frames in milliseconds (default %d)\n", ANIMATION_DELAY_MS);
+    printf("    -F, --fps N       Solve at full speed and draw N frames a second, skipping moves\n");
+    printf("    -H, --headless    Solve without rendering and report the result and time taken\n");
+    printf("    -p, --poles N     Number of poles (default %d)\n", DEFAULT_NUM_POLES);
+    printf("    -e, --engine NAME Solver to use: recursive, iterative, parallel or frame-stewart\n");
+    printf("                      (default: recursive for 3 poles, frame-stewart otherwise)\n");
+    printf("    -t, --threads N   Threads used by the parallel engine (default: number of CPUs)\n");
+    printf("    -s, --seek MOVE   Start from the state after MOVE moves\n");
+    printf("    -o, --output FILE Write the moves to FILE, or stdout if it is -, instead of rendering\n");
+    printf("    -f, --format FMT  Format of the moves written: binary (default) or text\n");
+    printf("    -r, --replay FILE Replay and check the moves in a binary move log instead of solving\n");
+    printf("    -I, --initial CONFIG\n");
+    printf("                      Start from CONFIG, the pole of each disk from the largest, as in 0120\n");
+    printf("    -G, --goal CONFIG Solve to CONFIG instead of every disk on the last pole\n");
+    printf("    -k, --checkpoint FILE\n");
+    printf("                      Save the progress of the solve to FILE every so often\n");
+    printf("    -i, --checkpoint-interval S\n");
+    printf("                      Seconds between checkpoints (default %d)\n", DEFAULT_CHECKPOINT_INTERVAL_S);
+    printf("    -u, --resume FILE Continue the solve saved in the checkpoint FILE\n");
+    printf("    -b, --batch FILE  Run the jobs in FILE, or stdin if it is -, and print a CSV row for each\n");
+    printf("    -B, --bench       Benchmark the engines, renderers and colormap loading as CSV\n");
+    printf("    -c, --colormap FILE\n");
+    printf("                      Load the disk colors from a csv file of r,g,b rows instead of\n");
+    printf("                      the built in %s\n", COLORMAP_FILE);
+    printf("    -C, --colors MODE Colors the terminal supports: truecolor (default), 256, 16 or none\n");
+    printf("    -O, --backend NAME\n");
+    printf("                      Where frames go: terminal (default), full (the terminal, redrawn\n");
+    printf("                      in full every frame), null, text (no escape sequences) or cast\n");
+    printf("                      (an asciinema recording on stdout)\n");
+    printf("    -v, --viewport MODE\n");
+    printf("                      Fit towers too large for the terminal by scaling them down\n");
+    printf("                      or drawing only the top of each pole: scale or top\n");
+    printf("    -R, --render-thread POLICY\n");
+    printf("                      Render on a separate thread, which when behind either blocks\n");
+    printf("                      the solver or skips frames: block or skip\n");
+    printf("    -S, --stats       Print where the time went at exit (requires make S=1)\n");
+    printf("    -h, --help        Print this text\n");
+}
+
+/*
+ * Parses the command line into options. Prints the usage and exits if it is
+ * invalid.
+ */
+struct Options parse_options(int argc, char* argv[]) {
+    struct Options options;
+    options.num_layers = -1;
+    options.delay_ms = ANIMATION_DELAY_MS;
+    options.fps = 0;
+    options.headless = false;
+    options.engine = ENGINE_RECURSIVE;
+    options.seek = false;
+    options.seek_move = 0;
+    options.num_threads = get_num_cpus();
+    options.threads_given = false;
+    options.num_poles = DEFAULT_NUM_POLES;
+    options.engine_given = false;
+    options.output = NULL;
+    options.output_format = MOVE_LOG_BINARY;
+    options.replay = NULL;
+    options.bench = false;
+    options.stats = false;
+    options.render_thread = false;
+    options.render_policy = RENDER_BLOCK;
+    options.colormap = NULL;
+    options.color_mode = COLOR_TRUECOLOR;
+    options.backend = BACKEND_TERMINAL;
+    options.full_redraw = false;
+    options.viewport = VIEWPORT_NONE;
+    options.checkpoint = NULL;
+    options.checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL_S;
+    options.resume = NULL;
+    options.batch = NULL;
+    options.initial = NULL;
+    options.goal = NULL;
+
+    static struct option long_options[] = {
+        {"delay", required_argument, NULL, 'd'},
+        {"fps", required_argument, NULL, 'F'},
+        {"headless", no_argument, NULL, 'H'},
+        {"poles", required_argument, NULL, 'p'},
+        {"engine", required_argument, NULL, 'e'},
+        {"seek", required_argument, NULL, 's'},
+        {"threads", required_argument, NULL, 't'},
+        {"output", required_argument, NULL, 'o'},
+        {"format", required_argument, NULL, 'f'},
+        {"replay", required_argument, NULL, 'r'},
+        {"initial", required_argument, NULL, 'I'},
+        {"goal", required_argument, NULL, 'G'},
+        {"batch", required_argument, NULL, 'b'},
+        {"bench", no_argument, NULL, 'B'},
+        {"stats", no_argument, NULL, 'S'},
+        {"render-thread", required_argument, NULL, 'R'},
+        {"colormap", required_argument, NULL, 'c'},
+        {"colors", required_argument, NULL, 'C'},
+        {"backend", required_argument, NULL, 'O'},
+        {"viewport", required_argument, NULL, 'v'},
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"checkpoint-interval", required_argument, NULL, 'i'},
+        {"resume", required_argument, NULL, 'u'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:F:Hp:e:s:t:o:f:r:I:G:b:BSR:c:C:O:v:k:i:u:h", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            if (!string_to_option(optarg, "delay", 0, INT_MAX, &options.delay_ms)) {
+                exit(1);
+            }
             break;
-        } else if(n != 3) {
-            // The format must be invalid
-            fprintf(stderr, "Error: colormap file format invalid\n");
-            free(cmap.colors);
-            cmap.length = -1;
-            return cmap;
-        }
-        // Check validity
-        if (r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255) {
-            fprintf(stderr, "Error: record %d: %d %d %d out of range\n", i + 1, r, g, b);
-            free(cmap.colors);
-            cmap.length = -1;
-            return cmap;
-        }
-        // Resize array if it is full
-        if (i == arraysize) {
-            arraysize += ARRAY_RESIZE_INCREMENT;
-            cmap.colors = realloc(cmap.colors, arraysize * sizeof(*cmap.colors));
-            if (cmap.colors == NULL) {
-                perror("Error");
-                free(cmap.colors);
-                cmap.length = -1;
-                return cmap;
+        case 'F':
+            if (!string_to_option(optarg, "fps", 1, MAX_FPS, &options.fps)) {
+                exit(1);
+            }
+            break;
+        case 'H':
+            options.headless = true;
+            break;
+        case 'p':
+            if (!string_to_option(optarg, "poles", 3, MAX_NUM_POLES, &options.num_poles)) {
+                exit(1);
+            }
+            break;
+        case 'e':
+            options.engine_given = true;
+            if (strcmp(optarg, "recursive") == 0) {
+                options.engine = ENGINE_RECURSIVE;
+            } else if (strcmp(optarg, "iterative") == 0) {
+                options.engine = ENGINE_ITERATIVE;
+            } else if (strcmp(optarg, "parallel") == 0) {
+                options.engine = ENGINE_PARALLEL;
+            } else if (strcmp(optarg, "frame-stewart") == 0) {
+                options.engine = ENGINE_FRAME_STEWART;
+            } else {
+                fprintf(stderr, "Error: unknown engine %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            if (!string_to_move(optarg, &options.seek_move)) {
+                exit(1);
+            }
+            options.seek = true;
+            break;
+        case 't':
+            if (!string_to_option(optarg, "threads", 1, INT_MAX, &options.num_threads)) {
+                exit(1);
+            }
+            options.threads_given = true;
+            break;
+        case 'o':
+            options.output = optarg;
+            options.headless = true;
+            break;
+        case 'f':
+            if (strcmp(optarg, "binary") == 0) {
+                options.output_format = MOVE_LOG_BINARY;
+            } else if (strcmp(optarg, "text") == 0) {
+                options.output_format = MOVE_LOG_TEXT;
+            } else {
+                fprintf(stderr, "Error: unknown format %s\n", optarg);
+                exit(1);
             }
+            break;
+        case 'r':
+            options.replay = optarg;
+            break;
+        case 'I':
+            options.initial = optarg;
+            break;
+        case 'G':
+            options.goal = optarg;
+            break;
+        case 'b':
+            options.batch = optarg;
+            break;
+        case 'B':
+            options.bench = true;
+            break;
+        case 'R':
+            options.render_thread = true;
+            if (strcmp(optarg, "block") == 0) {
+                options.render_policy = RENDER_BLOCK;
+            } else if (strcmp(optarg, "skip") == 0) {
+                options.render_policy = RENDER_SKIP;
+            } else {
+                fprintf(stderr, "Error: unknown render policy %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            options.colormap = optarg;
+            break;
+        case 'k':
+            options.checkpoint = optarg;
+            break;
+        case 'i':
+            if (!string_to_option(optarg, "checkpoint interval", 1, INT_MAX, &options.checkpoint_interval)) {
+                exit(1);
+            }
+            break;
+        case 'u':
+            options.resume = optarg;
+            break;
+        case 'v':
+            if (strcmp(optarg, "scale") == 0) {
+                options.viewport = VIEWPORT_SCALE;
+            } else if (strcmp(optarg, "top") == 0) {
+                options.viewport = VIEWPORT_TOP;
+            } else {
+                fprintf(stderr, "Error: unknown viewport %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'C':
+            if (strcmp(optarg, "truecolor") == 0) {
+                options.color_mode = COLOR_TRUECOLOR;
+            } else if (strcmp(optarg, "256") == 0) {
+                options.color_mode = COLOR_256;
+            } else if (strcmp(optarg, "16") == 0) {
+                options.color_mode = COLOR_16;
+            } else if (strcmp(optarg, "none") == 0) {
+                options.color_mode = COLOR_NONE;
+            } else {
+                fprintf(stderr, "Error: unknown color mode %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'O':
+            options.backend = BACKEND_TERMINAL;
+            options.full_redraw = false;
+            if (strcmp(optarg, "full") == 0) {
+                options.full_redraw = true;
+            } else if (strcmp(optarg, "null") == 0) {
+                options.backend = BACKEND_NULL;
+            } else if (strcmp(optarg, "text") == 0) {
+                options.backend = BACKEND_TEXT;
+            } else if (strcmp(optarg, "cast") == 0) {
+                options.backend = BACKEND_CAST;
+            } else if (strcmp(optarg, "terminal") != 0) {
+                fprintf(stderr, "Error: unknown backend %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'S':
+#ifndef HANOI_STATS
+            fprintf(stderr, "Error: --stats requires building with make S=1\n");
+            exit(1);
+#endif
+            options.stats = true;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(0);
+        default:
+            print_usage(argv[0]);
+            exit(1);
         }
-        cmap.colors[i].r = r;
-        cmap.colors[i].g = g;
-        cmap.colors[i].b = b;
-        i++;
     }
-    fclose(file);
-    
-    // Shrink the array if necessary
-    if (i != arraysize) {
-        // In case realloc fails
-        struct Color *newptr = realloc(cmap.colors, i * sizeof(*newptr));
-        if(newptr != NULL) {
-            cmap.colors = newptr;
+
+    if (!options.engine_given && options.num_poles > 3) {
+        options.engine = ENGINE_FRAME_STEWART;
+    }
+    if (options.initial != NULL || options.goal != NULL) {
+        if (options.engine_given || options.num_poles != 3 || options.seek || options.replay != NULL ||
+                options.checkpoint != NULL || options.resume != NULL || options.batch != NULL || argc - optind > 0) {
+            fprintf(stderr, "Error: --initial and --goal take the number of layers from the configuration, require 3 poles and cannot be used with --engine, --seek, --replay, --checkpoint, --resume or --batch\n");
+            exit(1);
+        }
+        if (options.output != NULL && options.output_format == MOVE_LOG_BINARY) {
+            fprintf(stderr, "Error: binary move logs record full solves from the first pole to the last, so --initial and --goal require --format text\n");
+            exit(1);
         }
+        options.engine = ENGINE_CONFIGURATION;
+    }
+    bool closed_form = options.engine == ENGINE_ITERATIVE || options.engine == ENGINE_PARALLEL || options.seek;
+    if (closed_form && options.num_poles != 3) {
+        fprintf(stderr, "Error: the iterative and parallel engines and seeking require 3 poles\n");
+        exit(1);
+    }
+    if (options.output != NULL && options.engine == ENGINE_PARALLEL) {
+        fprintf(stderr, "Error: the parallel engine cannot write moves\n");
+        exit(1);
+    }
+    if ((options.checkpoint != NULL || options.resume != NULL) &&
+            (options.num_poles != 3 || options.engine == ENGINE_FRAME_STEWART)) {
+        fprintf(stderr, "Error: checkpoints require 3 poles and cannot be used with the frame-stewart engine\n");
+        exit(1);
+    }
+    if (options.checkpoint != NULL && options.engine == ENGINE_PARALLEL) {
+        fprintf(stderr, "Error: the parallel engine cannot save checkpoints\n");
+        exit(1);
     }
-    cmap.length = i;
-    return cmap;
+    if (options.resume != NULL && (options.seek || options.replay != NULL || argc - optind > 0)) {
+        fprintf(stderr, "Error: --resume takes the number of layers and moves from the checkpoint and cannot be used with --seek or --replay\n");
+        exit(1);
+    }
+    if (options.seek && options.engine == ENGINE_FRAME_STEWART) {
+        fprintf(stderr, "Error: the frame-stewart engine cannot seek\n");
+        exit(1);
+    }
+
+    if (options.render_thread && (options.headless || options.replay != NULL)) {
+        fprintf(stderr, "Error: --render-thread cannot be used with --headless, --output or --replay\n");
+        exit(1);
+    }
+
+    if (options.replay != NULL && (options.output != NULL || options.seek || argc - optind > 0)) {
+        fprintf(stderr, "Error: --replay takes the number of layers from the move log and cannot be used with --output or --seek\n");
+        exit(1);
+    }
+
+    if (options.batch != NULL && (options.engine == ENGINE_PARALLEL || options.seek || options.output != NULL ||
+                                  options.replay != NULL || options.checkpoint != NULL || options.resume != NULL ||
+                                  options.render_thread || options.bench || options.backend != BACKEND_TERMINAL ||
+                                  options.full_redraw || argc - optind > 0)) {
+        fprintf(stderr, "Error: --batch takes the number of layers from each job and cannot be used with the parallel engine, --seek, --output, --replay, --checkpoint, --resume, --render-thread, --bench or --backend\n");
+        exit(1);
+    }
+
+    if (argc - optind > 1) {
+        print_usage(argv[0]);
+        exit(1);
+    }
+    if (argc - optind == 1) {
+        options.num_layers = string_to_num_layers(argv[optind]);
+        if (options.num_layers == -1) {
+            exit(1);
+        }
+    }
+    return options;
 }
 
 /*
- * Frees dynamically allocated memory
+ * Prints the message of error and exits if it is not HANOI_OK
  */
-void destroy_colormap(struct ColorMap colormap) {
-    free(colormap.colors);
+void exit_on_error(enum HanoiError error) {
+    if (error != HANOI_OK) {
+        // Keep the error after whatever was printed before it
+        fflush(stdout);
+        fprintf(stderr, "Error: %s\n", get_error_message());
+        exit(1);
+    }
 }
 
 /*
- * Prints a string n times
+ * Returns the colormap loaded from filename, or the built in one if filename is
+ * NULL. Exits on failure.
  */
-void print_repeat(char str[], int count) {
-    for (int i = 0; i < count; i++) {
-        fputs(str, stdout);
+struct ColorMap get_colormap(const char *filename) {
+    if (filename == NULL) {
+        return embedded_colormap();
     }
+    struct ColorMap colormap;
+    exit_on_error(load_colormap(filename, &colormap));
+    return colormap;
 }
 
 /*
- * Prints a string n times with a certain color
+ * Frees a colormap returned by get_colormap for filename
  */
-void print_repeat_color(char str[], int count, struct Color color) {
-    int buf_size = 256;
-    char colored_str[buf_size];
-    snprintf(colored_str, buf_size, "\033[38;2;%d;%d;%dm%s\033[0;0m", color.r, color.g, color.b, str);
-    for (int i = 0; i < count; i++) {
-        fputs(colored_str, stdout);
+void release_colormap(struct ColorMap colormap, const char *filename) {
+    if (filename != NULL) {
+        destroy_colormap(colormap);
     }
 }
 
 /*
- * Renders a single layer of a pole. layer is zero indexed
+ * Stops the checkpointer of game_state. A checkpoint that could not be written
+ * does not affect the solve, so it is only warned about.
  */
-void render_layer_pole(struct Pole pole, int num_layers, int layer) {
-    if (pole.num_disk <= layer) {
-        // No disk at this layer
-        print_repeat(EMPTY, num_layers - 1);
-        fputs(ROD, stdout);
-        print_repeat(EMPTY, num_layers - 1);
-    } else {
-        // Disk at this layer
-        int disk_size = pole.disks[layer].size;
-        struct Color disk_color = pole.disks[layer].color;
-        print_repeat(EMPTY, num_layers - disk_size);
-        print_repeat_color(DISK, disk_size * 2 - 1, disk_color);
-        // print_repeat(DISK, disk_size * 2 - 1);
-        print_repeat(EMPTY, num_layers - disk_size);
+void finish_checkpoints(struct GameState *game_state) {
+    if (stop_checkpointer(game_state) != HANOI_OK) {
+        fprintf(stderr, "Warning: %s\n", get_error_message());
     }
 }
 
-
 /*
- * Renders a single layer of poles. layer is zero indexed
+ * Prints a line with the label and a move count
  */
-void render_layer(struct GameState game_state, int layer) {
-    for (int i = 0; i < NUM_POLES; i++) {
-        render_layer_pole(game_state.poles[i], game_state.num_layers, layer);
-        if (i != NUM_POLES - 1) {
-            print_repeat(EMPTY, SPACE_BETWEEN_POLES);
-        }
-    }
+void print_move_count(FILE *file, const char *label, MoveCount count) {
+    char text[MOVE_COUNT_MAX_DIGITS + 1];
+    format_move_count(text, sizeof(text), count);
+    fprintf(file, "%s: %s\n", label, text);
 }
 
 /*
- * Clears the previosly drawn image
+ * Replays the binary move log given in the options, rendering it unless
+ * running headless, and reports the result. Returns the exit status.
  */
-void erase_drawing(struct GameState game_state) {
-    for (int i = 0; i < game_state.num_layers + 1; i++) {
-        printf("\033[A");
-        printf("\r");
-        printf("\033[J");
+int replay(struct Options options, FILE *info) {
+    struct MappedFile file;
+    exit_on_error(map_file(options.replay, &file));
+    struct MoveLogHeader header;
+    exit_on_error(read_move_log_header(file.data, file.length, &header));
+    double startup_time = get_time_seconds();
+    fprintf(info, "Number of layers: %d\n", header.num_layers);
+
+    struct GameState game_state;
+    exit_on_error(initialize_game_state(&game_state, header.num_layers, header.num_poles));
+    game_state.headless = options.headless;
+    game_state.delay_ms = options.delay_ms;
+    game_state.color_mode = options.color_mode;
+    game_state.backend = options.backend;
+    game_state.differential = !options.full_redraw;
+    game_state.viewport.mode = options.viewport;
+    if (options.fps > 0) {
+        set_frame_rate(&game_state, options.fps);
     }
-}
+    if (header.start_move > 0 && set_state_at_move(&game_state, header.start_move) != HANOI_OK) {
+        fflush(stdout);
+        fprintf(stderr, "Error: move log cannot start after move %llu: %s\n", header.start_move,
+                get_error_message());
+        exit(1);
+    }
+    game_state.total_moves = header.start_move + header.num_moves;
 
+    const unsigned char *moves = file.data + header.header_size;
+    size_t num_bytes = file.length - header.header_size;
+    unsigned long long num_legal;
+    double start = get_time_seconds();
+    if (options.headless) {
+        num_legal = check_moves(&game_state, moves, num_bytes, header.num_moves, header.bits_per_move);
+    } else {
+        struct ColorMap colormap = get_colormap(options.colormap);
+        exit_on_error(initialize_rendering(&game_state, colormap));
+        release_colormap(colormap, options.colormap);
+        draw(game_state);
+        num_legal = replay_moves(&game_state, moves, num_bytes, header.num_moves, header.bits_per_move);
+        if (game_state.error == HANOI_OK) {
+            finish_animation(game_state);
+            game_state.error = game_state.frame_buffer->error;
+        }
+        destroy_rendering(&game_state);
+    }
+    double elapsed = get_time_seconds() - start;
+
+    int status = 0;
+    fflush(info);
+    if (game_state.error != HANOI_OK) {
+        fprintf(stderr, "Error: %s\n", get_error_message());
+        status = 1;
+    } else if (num_legal != header.num_moves) {
+        fprintf(stderr, "Error: move %llu is illegal\n", header.start_move + num_legal + 1);
+        status = 1;
+    }
+    print_move_count(info, "Moves", game_state.num_moves);
+    fprintf(info, "Checksum: %016llx\n", game_state.checksum);
+    fprintf(info, "Solved: %s\n", is_solved(game_state) ? "yes" : "no");
+    fprintf(info, "Time: %.6f s\n", elapsed);
+    if (options.stats) {
+        print_stats(info, elapsed, startup_time);
+    }
+    destroy_game_state(&game_state);
+    unmap_file(&file);
+    return status;
+}
 
 /*
- * Draws the number of steps and poles
+ * One solve of a batch and its result
  */
-void draw(struct GameState game_state) {
-    printf("Moves: %ld / %ld\n", game_state.num_moves, (1L << (long) game_state.num_layers) - 1L);
-    for (int i = game_state.num_layers - 1; i >= 0; i--) {
-        render_layer(game_state, i);
-        printf("\n");
-    }
-    // Sleep to show the frame
-    struct timespec tv;
-    tv.tv_sec = ANIMATION_DELAY_MS / S_TO_MS_MULTIPLIER;
-    tv.tv_nsec = (ANIMATION_DELAY_MS % S_TO_MS_MULTIPLIER) * MS_TO_NS_MULTIPLIER;
-    nanosleep(&tv, NULL);
-}
+struct Job {
+    int line; // The line of the batch file the job is on
+    int num_layers;
+    int num_poles;
+    bool render; // Whether the frames are drawn, to the null backend, or only the moves made
+    enum Engine engine;
+    // Set once the job has run
+    MoveCount num_moves;
+    unsigned long long checksum;
+    bool solved;
+    double seconds;
+    unsigned long long frames;
+    unsigned long long bytes;
+    enum HanoiError error;
+    char error_message[ERROR_MESSAGE_MAX_LENGTH];
+    bool done; // Guarded by the mutex of the batch
+};
 
 /*
- * Replaces the previous drawing
+ * The jobs of a batch and what they share. Each worker thread takes the next
+ * job that has not been started until there are none left.
  */
-void redraw(struct GameState game_state) {
-    erase_drawing(game_state);
-    draw(game_state);
-}
+struct Batch {
+    struct Job *jobs;
+    int num_jobs;
+    enum ColorMode color_mode;
+    struct ColorMap colormap; // Loaded once for every job that renders
+    struct SplitTable split_table; // Filled in once for the largest Frame-Stewart job
+    pthread_mutex_t mutex;
+    pthread_cond_t finished; // Signaled when a job is done
+    int next_job; // Guarded by mutex
+};
 
 /*
- * Intializes an array of NUM_POLES poles, with the first being full and the rest
- * empty
+ * Parses a job of the form "num_layers [num_poles [headless|render]]" from a
+ * line of a batch file, with the number of poles and mode defaulting to those in
+ * the options. Returns false if the line is malformed.
  */
-void initialize_poles(struct Pole poles[NUM_POLES], int num_layers, struct ColorMap colormap) {
-    // The minus one is because we use zero indexing when going through the map
-    // Special case to avoid dividing by zero
-    int colormap_increment;
-    if (num_layers == 1) {
-        colormap_increment = 0;
-    } else{
-        colormap_increment = colormap.length / (num_layers - 1);
-    }
-    if (colormap_increment < 1) {
-        colormap_increment = 1;
-    }
-    // Initialize all poles as empty
-    for (int i = 0; i < NUM_POLES; i++) {
-        poles[i].size = num_layers;
-        poles[i].num_disk = 0;
-        poles[i].disks = malloc_or_die(num_layers * sizeof(*(poles[i].disks)));
-    }
-    // Fill first pole
-    poles[0].num_disk = num_layers;
-    for (int i = 0; i < num_layers; i++) {
-        poles[0].disks[i].size = num_layers - i;
-        int colormap_index = colormap_increment * i;
-        if (colormap_index >= colormap.length) {
-            colormap_index = colormap.length - 1;
+bool parse_job(const char *line, struct Options options, struct Job *job) {
+    char layers[32], poles[32], mode[32], extra[2];
+    int num_fields = sscanf(line, "%31s %31s %31s %1s", layers, poles, mode, extra);
+    if (num_fields < 1 || num_fields > 3) {
+        return false;
+    }
+    char *end;
+    errno = 0;
+    long n = strtol(layers, &end, 10);
+    if (errno != 0 || *end != '\0' || n < 1 || n > INT_MAX) {
+        return false;
+    }
+    job->num_layers = (int) n;
+    job->num_poles = options.num_poles;
+    if (num_fields >= 2) {
+        long p = strtol(poles, &end, 10);
+        if (*end != '\0' || p < 3 || p > MAX_NUM_POLES) {
+            return false;
+        }
+        job->num_poles = (int) p;
+    }
+    job->render = !options.headless;
+    if (num_fields == 3) {
+        if (strcmp(mode, "headless") == 0) {
+            job->render = false;
+        } else if (strcmp(mode, "render") == 0) {
+            job->render = true;
+        } else {
+            return false;
         }
-        poles[0].disks[i].color = colormap.colors[colormap_index];
     }
+    job->engine = options.engine;
+    if (!options.engine_given) {
+        job->engine = job->num_poles > 3 ? ENGINE_FRAME_STEWART : ENGINE_RECURSIVE;
+    }
+    job->done = false;
+    return true;
 }
 
 /*
- * Frees dynamically allocated memory
+ * Reads the jobs of a batch file, skipping blank lines and everything after a #.
+ * Sets num_jobs and returns the jobs. Exits on failure.
  */
-void destroy_poles(struct Pole poles[NUM_POLES]) {
-    for (int i = 0; i < NUM_POLES; i++) {
-        free(poles[i].disks);
+struct Job* read_jobs(const char *filename, struct Options options, int *num_jobs) {
+    FILE *file = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    struct Job *jobs = NULL;
+    int capacity = 0;
+    *num_jobs = 0;
+    char buf[BATCH_LINE_MAX_LENGTH];
+    for (int line = 1; fgets(buf, sizeof(buf), file) != NULL; line++) {
+        size_t length = strlen(buf);
+        if (length == sizeof(buf) - 1 && buf[length - 1] != '\n' && !feof(file)) {
+            fprintf(stderr, "Error: %s:%d: line is too long\n", filename, line);
+            exit(1);
+        }
+        buf[strcspn(buf, "#")] = '\0';
+        if (buf[strspn(buf, " \t\r\n")] == '\0') {
+            continue;
+        }
+        if (*num_jobs == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 16;
+            jobs = realloc(jobs, capacity * sizeof(*jobs));
+            if (jobs == NULL) {
+                fprintf(stderr, "Error: out of memory for %d jobs\n", capacity);
+                exit(1);
+            }
+        }
+        struct Job *job = &jobs[*num_jobs];
+        if (!parse_job(buf, options, job)) {
+            fprintf(stderr, "Error: %s:%d: expected num_layers [num_poles [headless|render]]\n", filename, line);
+            exit(1);
+        }
+        job->line = line;
+        (*num_jobs)++;
     }
+    if (ferror(file)) {
+        fprintf(stderr, "Error: failed to read %s\n", filename);
+        exit(1);
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    return jobs;
 }
 
 /*
- * Takes a string representing the number of layers for the Tower of Hanoi
- * and converts it to an int while doing error and bounds checking.
- * If the string is invalid, it prints an error message and returns -1.
- * Returns the number of layers, or -1 on error
+ * Runs a job of the batch on game_state, which is reused from the last job the
+ * thread ran if initialized is set. Frames go to the null backend.
  */
-int string_to_num_layers(char arg[]) {
-    char* str_end;
-    long n = strtol(arg, &str_end, 10);
-    if (n == LONG_MIN || n == LONG_MAX) {
-        perror("Error: Invalid num_layers");
-        return -1;
+void run_job(struct Batch *batch, struct Job *job, struct GameState *game_state, bool *initialized) {
+    job->num_moves = 0;
+    job->checksum = 0;
+    job->solved = false;
+    job->seconds = 0;
+    job->frames = 0;
+    job->bytes = 0;
+    double start = get_time_seconds();
+    if (*initialized) {
+        job->error = reset_game_state(game_state, job->num_layers, job->num_poles);
+    } else {
+        job->error = initialize_game_state(game_state, job->num_layers, job->num_poles);
+        *initialized = job->error == HANOI_OK;
     }
-    if (*str_end != '\0') {
-        fprintf(stderr, "Error: num_layers must be an integer\n");
-        return -1;
+    if (job->error == HANOI_OK) {
+        game_state->headless = !job->render;
+        game_state->backend = BACKEND_NULL;
+        game_state->delay_ms = 0;
+        game_state->color_mode = batch->color_mode;
+        if (job->engine == ENGINE_FRAME_STEWART) {
+            game_state->split_table = &batch->split_table;
+            game_state->total_moves =
+                batch->split_table.moves[split_index(&batch->split_table, job->num_layers, job->num_poles)];
+        }
+        if (job->render) {
+            job->error = initialize_rendering(game_state, batch->colormap);
+        }
     }
-    if (n <= 0) {
-        fprintf(stderr, "Error: num_layers greater than zero\n");
-        return -1;
+    if (job->error == HANOI_OK && job->render) {
+        draw(*game_state);
+        job->error = solve_hanoi(game_state, job->engine, 1);
+        if (job->error == HANOI_OK) {
+            job->error = game_state->frame_buffer->error;
+        }
+        job->frames = game_state->frame_buffer->num_flushes;
+        job->bytes = game_state->frame_buffer->bytes_written;
+        destroy_rendering(game_state);
+    } else if (job->error == HANOI_OK) {
+        job->error = solve_hanoi(game_state, job->engine, 1);
     }
-    if (n > INT_MAX) {
-        fprintf(stderr, "Error: num_layers must be less than %d\n", INT_MAX);
-        return -1;
+    job->seconds = get_time_seconds() - start;
+    if (job->error != HANOI_OK) {
+        snprintf(job->error_message, sizeof(job->error_message), "%s", get_error_message());
+        return;
     }
-    return (int) n;
+    job->num_moves = game_state->num_moves;
+    job->checksum = game_state->checksum;
+    job->solved = is_solved(*game_state);
 }
 
-
 /*
- * Asks the user enter the number of layers and returns it. Repeats if the user
- * gives an invalid input.
- * 
- * Returns the number of layers, or -1 on error
+ * Thread entry point for running the jobs of a batch. The game state is kept
+ * from one job to the next so that only jobs larger than any before them
+ * allocate.
  */
-int get_num_layers_from_user() {
-    int buf_size = 64;
-    char buf[buf_size];
-    while(true) {
-        printf("Enter the number of layers: ");
-        if (fgets(buf, buf_size, stdin) == NULL) {
-            // Read failed or reached end of file
-            if (ferror(stdin)) {
-                perror("Error");
-            }
-            return -1;
-        }
-        // Strip trailing newline if necessary
-        int length = strlen(buf);
-        if (length > 0 && buf[length - 1] == '\n') {
-            buf[length -1] = '\0';
-        }
-        if (buf[0] == '\0') {
-            // Skip empty lines
-            continue;
-        }
-        int num_layers = string_to_num_layers(buf);
-        if (num_layers == -1) {
-            // Failed to convert to int
-            continue;
+void* run_batch_jobs(void *arg) {
+    struct Batch *batch = arg;
+    struct GameState game_state;
+    bool initialized = false;
+    while (true) {
+        pthread_mutex_lock(&batch->mutex);
+        int i = batch->next_job++;
+        pthread_mutex_unlock(&batch->mutex);
+        if (i >= batch->num_jobs) {
+            break;
         }
-        return num_layers;
+        run_job(batch, &batch->jobs[i], &game_state, &initialized);
+        pthread_mutex_lock(&batch->mutex);
+        batch->jobs[i].done = true;
+        pthread_cond_broadcast(&batch->finished);
+        pthread_mutex_unlock(&batch->mutex);
+    }
+    if (initialized) {
+        destroy_game_state(&game_state);
     }
+    return NULL;
 }
 
 /*
- * Returns index of pole that is not pole1 or pole2
+ * Prints the CSV row of the result of a job
  */
-int get_spare(int pole1, int pole2) {
-    for (int i = 0; i < NUM_POLES; i++) {
-        if (i != pole1 && i != pole2) {
-            return i;
-        }
+void print_job_result(FILE *file, struct Job job) {
+    static const char *engine_names[] = {"recursive", "iterative", "parallel", "frame-stewart", "configuration"};
+    char moves[MOVE_COUNT_MAX_DIGITS + 1];
+    format_move_count(moves, sizeof(moves), job.num_moves);
+    fprintf(file, "%d,%d,%d,%s,%s,%s,%016llx,%s,%.6f,%llu,%llu,", job.line, job.num_layers, job.num_poles,
+            job.render ? "render" : "headless", engine_names[job.engine], moves, job.checksum,
+            job.solved ? "yes" : "no", job.seconds, job.frames, job.bytes);
+    if (job.error != HANOI_OK) {
+        fprintf(file, "\"%s\"", job.error_message);
     }
-    // Should not occur
-    fprintf(stderr, "Error: could not find spare with pole1 = %d, pole2 = %d, NUM_POLES = %d\n", pole1, pole2, NUM_POLES);
-    exit(1);
+    fprintf(file, "\n");
+    fflush(file);
 }
 
 /*
- * Moves the top disk of src to dest
- *
- * If the attempted move is invalid, print an error message and exit the program.
+ * Runs every job in the batch file given in the options on a pool of threads,
+ * one unless chosen with --threads, and prints a CSV row for each job in the
+ * order of the file as soon as it and every job before it finish. Returns the
+ * exit status, which is 1 if any job failed.
  */
-void move_disk(struct GameState *game_state, int src, int dest) {
-    struct Pole *src_pole = &game_state->poles[src];
-    struct Pole *dest_pole = &game_state->poles[dest];
-    // Ensure that the src pole is not empty and the dest pole is not full for debugging.
-    // Should not occur
-    if (src_pole->num_disk <= 0) {
-        redraw(*game_state);
-        fprintf(stderr, "Error: src pole (%d) is empty\n", src);
-        exit(1);
+int run_batch(struct Options options) {
+    struct Batch batch;
+    batch.jobs = read_jobs(options.batch, options, &batch.num_jobs);
+    batch.color_mode = options.color_mode;
+    bool render = false;
+    int max_disks = 0, max_poles = 0;
+    for (int i = 0; i < batch.num_jobs; i++) {
+        struct Job job = batch.jobs[i];
+        render = render || job.render;
+        if (job.engine == ENGINE_FRAME_STEWART) {
+            max_disks = job.num_layers > max_disks ? job.num_layers : max_disks;
+            max_poles = job.num_poles > max_poles ? job.num_poles : max_poles;
+        }
     }
-    if (dest_pole->num_disk >= dest_pole->size) {
-        redraw(*game_state);
-        fprintf(stderr, "Error: dest pole (%d) is full\n", dest);
-        exit(1);
+    if (render) {
+        batch.colormap = get_colormap(options.colormap);
     }
+    if (max_disks > 0) {
+        exit_on_error(initialize_split_table(&batch.split_table, max_disks, max_poles));
+    }
+    pthread_mutex_init(&batch.mutex, NULL);
+    pthread_cond_init(&batch.finished, NULL);
+    batch.next_job = 0;
 
-    // Move the disk
-    dest_pole->disks[dest_pole->num_disk] = src_pole->disks[src_pole->num_disk - 1];
-    dest_pole->num_disk++;
-    src_pole->num_disk--;
-    game_state->num_moves++;
-
-    // Ensure there is not a larger piece on a smaller piece for debugging.
-    // Should not occur.
-    if (dest_pole->num_disk > 1) {
-        int top_size = dest_pole->disks[dest_pole->num_disk - 1].size;
-        int under_top_size = dest_pole->disks[dest_pole->num_disk - 2].size;
-        if (top_size > under_top_size) {
-            redraw(*game_state);
-            fprintf(stderr, "Error: attempted illegal move. This should not occur");
+    int num_threads = options.threads_given ? options.num_threads : 1;
+    if (num_threads > batch.num_jobs) {
+        num_threads = batch.num_jobs > 0 ? batch.num_jobs : 1;
+    }
+    pthread_t *threads = malloc(num_threads * sizeof(*threads));
+    if (threads == NULL) {
+        fprintf(stderr, "Error: out of memory for %d threads\n", num_threads);
+        exit(1);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        int error = pthread_create(&threads[i], NULL, run_batch_jobs, &batch);
+        if (error != 0) {
+            fprintf(stderr, "Error: failed to create thread: %s\n", strerror(error));
             exit(1);
         }
     }
 
-    redraw(*game_state);
+    printf("line,num_layers,num_poles,mode,engine,moves,checksum,solved,seconds,frames,bytes,error\n");
+    int status = 0;
+    for (int i = 0; i < batch.num_jobs; i++) {
+        pthread_mutex_lock(&batch.mutex);
+        while (!batch.jobs[i].done) {
+            pthread_cond_wait(&batch.finished, &batch.mutex);
+        }
+        pthread_mutex_unlock(&batch.mutex);
+        print_job_result(stdout, batch.jobs[i]);
+        if (batch.jobs[i].error != HANOI_OK) {
+            status = 1;
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    pthread_mutex_destroy(&batch.mutex);
+    pthread_cond_destroy(&batch.finished);
+    if (max_disks > 0) {
+        destroy_split_table(&batch.split_table);
+    }
+    if (render) {
+        release_colormap(batch.colormap, options.colormap);
+    }
+    free(batch.jobs);
+    return status;
 }
 
 /*
- * Move a stack of "size" disks from the src to dest pole. Renders each step.
+ * Returns the peak resident set size of the process so far in kilobytes, or -1
+ * if it is not known
  */
-void move_stack(struct GameState *game_state, int size, int src, int dest) {
-    if (size == 1) {
-        move_disk(game_state, src, dest);
-    } else {
-        int spare = get_spare(src, dest);
-        move_stack(game_state, size - 1, src, spare);
-        move_stack(game_state, 1, src, dest);
-        move_stack(game_state, size - 1, spare, dest);
+long get_peak_rss_kb() {
+#ifdef _WIN32
+    return -1;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
     }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // macOS reports bytes
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
 }
 
-#ifdef _WIN32
 /*
- * Windows shells do not enable virtual terminal by default so this is necessary
- * to ensure that the colors are printed correctly.
+ * Prints one row of benchmark results. seconds is the time taken by one run and
+ * frames is the number of frames drawn in it.
  */
-void enable_virtual_terminal_windows() {
-    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
-    DWORD mode;
-    if (!GetConsoleMode(out, mode)) {
-        printf("Error enabling enabling virtual terminal\n");
-        return;
-    }
-    if (!SetConsoleMode(out, mode | ENABLE_PROCESSED_OUTPUT | ENABLE_VIRTUAL_TERMINAL_PROCESSING)) {
-        printf("Error enabling enabling virtual terminal\n");
-        return;
-    }
+void print_bench_result(const char *benchmark, const char *variant, int num_layers, int num_poles,
+                        unsigned long long moves, double seconds, unsigned long long frames,
+                        unsigned long long bytes) {
+    double moves_per_s = seconds > 0 ? moves / seconds : 0;
+    double ns_per_move = moves > 0 ? seconds * S_TO_NS_MULTIPLIER / moves : 0;
+    double bytes_per_frame = frames > 0 ? (double) bytes / frames : 0;
+    printf("%s,%s,%d,%d,%llu,%.9f,%.0f,%.3f,%.1f,%ld\n", benchmark, variant, num_layers, num_poles,
+           moves, seconds, moves_per_s, ns_per_move, bytes_per_frame, get_peak_rss_kb());
+    fflush(stdout);
+}
+
+/*
+ * Times solving num_layers layers on num_poles poles headless with engine
+ */
+void bench_engine(const char *name, enum Engine engine, int num_layers, int num_poles, int num_threads) {
+    unsigned long long runs = 0, moves = 0;
+    double start = get_time_seconds();
+    double elapsed;
+    do {
+        struct GameState game_state;
+        exit_on_error(initialize_game_state(&game_state, num_layers, num_poles));
+        game_state.headless = true;
+        struct SplitTable split_table;
+        if (engine == ENGINE_FRAME_STEWART) {
+            exit_on_error(initialize_split_table(&split_table, num_layers, num_poles));
+            game_state.split_table = &split_table;
+        }
+        exit_on_error(solve_hanoi(&game_state, engine, num_threads));
+        moves = game_state.num_moves;
+        if (engine == ENGINE_FRAME_STEWART) {
+            destroy_split_table(&split_table);
+        }
+        destroy_game_state(&game_state);
+        runs++;
+        elapsed = get_time_seconds() - start;
+    } while (elapsed < BENCH_MIN_TIME_S);
+    print_bench_result("engine", name, num_layers, num_poles, moves, elapsed / runs, 0, 0);
+}
+
+/*
+ * Times solving and rendering num_layers layers with no delay. The frames go to
+ * the null backend so that only the cost of producing them is measured.
+ */
+void bench_renderer(const char *name, bool differential, int num_layers) {
+    unsigned long long runs = 0, moves = 0, frames = 0, bytes = 0;
+    double total = 0;
+    do {
+        struct GameState game_state;
+        exit_on_error(initialize_game_state(&game_state, num_layers, DEFAULT_NUM_POLES));
+        game_state.backend = BACKEND_NULL;
+        game_state.differential = differential;
+        game_state.delay_ms = 0;
+        exit_on_error(initialize_rendering(&game_state, embedded_colormap()));
+        double start = get_time_seconds();
+        draw(game_state);
+        exit_on_error(solve_hanoi(&game_state, ENGINE_RECURSIVE, 1));
+        total += get_time_seconds() - start;
+        moves = game_state.num_moves;
+        frames = game_state.frame_buffer->num_flushes;
+        bytes = game_state.frame_buffer->bytes_written;
+        destroy_rendering(&game_state);
+        destroy_game_state(&game_state);
+        runs++;
+    } while (total < BENCH_MIN_TIME_S);
+    print_bench_result("renderer", name, num_layers, DEFAULT_NUM_POLES, moves, total / runs, frames, bytes);
+}
+
+/*
+ * Times getting from the number of layers to the first frame: setting up the
+ * game state and rendering with the built in colormap, and drawing the frame to
+ * the null backend
+ */
+void bench_startup(int num_layers) {
+    unsigned long long runs = 0, bytes = 0;
+    double start = get_time_seconds();
+    double elapsed;
+    do {
+        struct GameState game_state;
+        exit_on_error(initialize_game_state(&game_state, num_layers, DEFAULT_NUM_POLES));
+        game_state.backend = BACKEND_NULL;
+        game_state.delay_ms = 0;
+        exit_on_error(initialize_rendering(&game_state, embedded_colormap()));
+        draw(game_state);
+        bytes = game_state.frame_buffer->bytes_written;
+        destroy_rendering(&game_state);
+        destroy_game_state(&game_state);
+        runs++;
+        elapsed = get_time_seconds() - start;
+    } while (elapsed < BENCH_MIN_TIME_S);
+    print_bench_result("startup", "first-frame", num_layers, DEFAULT_NUM_POLES, 0, elapsed / runs, 1, bytes);
 }
-#endif
 
-void solve_hanoi(struct GameState *game_state) {
-    move_stack(game_state, game_state->num_layers, 0, NUM_POLES - 1);
+/*
+ * Times loading and freeing the colormap
+ */
+void bench_colormap() {
+    unsigned long long runs = 0;
+    double start = get_time_seconds();
+    double elapsed;
+    do {
+        for (int i = 0; i < BENCH_COLORMAP_LOADS; i++) {
+            struct ColorMap colormap;
+            exit_on_error(load_colormap(COLORMAP_FILE, &colormap));
+            destroy_colormap(colormap);
+        }
+        runs += BENCH_COLORMAP_LOADS;
+        elapsed = get_time_seconds() - start;
+    } while (elapsed < BENCH_MIN_TIME_S);
+    print_bench_result("colormap", "load", 0, 0, 0, elapsed / runs, 0, 0);
+}
+
+/*
+ * Runs every benchmark across a range of layers and prints the results to
+ * stdout as CSV, one row per measurement. Times are per run.
+ */
+void run_benchmarks(int num_threads) {
+    static const int engine_layers[] = {4, 8, 12, 16, 20, 24};
+    static const int renderer_layers[] = {4, 8, 12, 16};
+    int num_engine_layers = sizeof(engine_layers) / sizeof(*engine_layers);
+    int num_renderer_layers = sizeof(renderer_layers) / sizeof(*renderer_layers);
+
+    printf("benchmark,variant,num_layers,num_poles,moves,seconds,moves_per_s,ns_per_move,bytes_per_frame,peak_rss_kb\n");
+    for (int i = 0; i < num_engine_layers; i++) {
+        int n = engine_layers[i];
+        bench_engine("recursive", ENGINE_RECURSIVE, n, DEFAULT_NUM_POLES, num_threads);
+        bench_engine("iterative", ENGINE_ITERATIVE, n, DEFAULT_NUM_POLES, num_threads);
+        bench_engine("parallel", ENGINE_PARALLEL, n, DEFAULT_NUM_POLES, num_threads);
+        bench_engine("frame-stewart", ENGINE_FRAME_STEWART, n, 4, num_threads);
+    }
+    for (int i = 0; i < num_renderer_layers; i++) {
+        int n = renderer_layers[i];
+        bench_renderer("full", false, n);
+        bench_renderer("differential", true, n);
+        bench_startup(n);
+    }
+    bench_colormap();
 }
 
 int main(int argc, char* argv[]) {
+    // Frames are written with one call each, but anything printed around them
+    // is held until the next frame or exit instead of written a line at a time
+    setvbuf(stdout, NULL, _IOFBF, STDOUT_BUFFER_SIZE);
 #ifdef _WIN32
     printf("Running WIN32\n");
     enable_virtual_terminal_windows();
 #endif
-    if (argc > 2) {
-        printf("Usage: %s [num_layers]\n", argv[0]);
-        exit(1);
+    struct Options options = parse_options(argc, argv);
+    // Keep messages out of the moves or cast when they are written to stdout
+    FILE *info = stdout;
+    if ((options.output != NULL && strcmp(options.output, "-") == 0) || options.backend == BACKEND_CAST) {
+        info = stderr;
+    }
+    if (options.replay != NULL) {
+        return replay(options, info);
+    }
+    if (options.bench) {
+        run_benchmarks(options.num_threads);
+        return 0;
+    }
+    if (options.batch != NULL) {
+        return run_batch(options);
     }
 
     // Get num_layers
-    int num_layers;
-    if (argc == 2) {
-        num_layers = string_to_num_layers(argv[1]);
-    } else {
+    int num_layers = options.num_layers;
+    int initial[CLOSED_FORM_MAX_LAYERS];
+    int goal[CLOSED_FORM_MAX_LAYERS];
+    if (options.initial != NULL) {
+        num_layers = string_to_configuration(options.initial, "initial configuration", initial);
+        if (num_layers == -1) {
+            exit(1);
+        }
+    }
+    if (options.goal != NULL) {
+        int goal_layers = string_to_configuration(options.goal, "goal configuration", goal);
+        if (goal_layers == -1) {
+            exit(1);
+        }
+        if (options.initial != NULL && goal_layers != num_layers) {
+            fprintf(stderr, "Error: the initial configuration has %d disks but the goal has %d\n", num_layers,
+                    goal_layers);
+            exit(1);
+        }
+        num_layers = goal_layers;
+    } else if (options.initial != NULL) {
+        for (int i = 0; i < num_layers; i++) {
+            goal[i] = 2;
+        }
+    }
+    struct Checkpoint checkpoint;
+    if (options.resume != NULL) {
+        exit_on_error(read_checkpoint(options.resume, &checkpoint));
+        if (checkpoint.num_poles != 3) {
+            fprintf(stderr, "Error: checkpoint is of %d poles instead of 3\n", checkpoint.num_poles);
+            exit(1);
+        }
+        num_layers = checkpoint.num_layers;
+    }
+    if (num_layers == -1) {
         num_layers = get_num_layers_from_user();
     }
     if (num_layers == -1) {
         exit(1);
     }
-    printf("Number of layers: %d\n", num_layers);
-
-    // Load colormap
-    struct ColorMap colormap = load_colormap(COLORMAP_FILE);
-    if (colormap.length == -1) {
-        fprintf(stderr, "Error: Failed to load colormap from %s\n", COLORMAP_FILE);
+    bool closed_form = options.engine == ENGINE_ITERATIVE || options.engine == ENGINE_PARALLEL;
+    if (closed_form && num_layers > CLOSED_FORM_MAX_LAYERS) {
+        fprintf(stderr, "Error: the iterative and parallel engines support at most %d layers\n", CLOSED_FORM_MAX_LAYERS);
         exit(1);
     }
-
-    // Initialize poles
-    struct Pole poles[NUM_POLES];
-    initialize_poles(poles, num_layers, colormap);
-    destroy_colormap(colormap);
+    if (options.engine == ENGINE_PARALLEL && !options.headless) {
+        fprintf(stderr, "Error: the parallel engine can only be used with --headless\n");
+        exit(1);
+    }
+    if ((options.checkpoint != NULL || options.resume != NULL) && num_layers > CLOSED_FORM_MAX_LAYERS) {
+        fprintf(stderr, "Error: checkpoints support at most %d layers\n", CLOSED_FORM_MAX_LAYERS);
+        exit(1);
+    }
+    // The time to the first frame is measured from here
+    double startup_time = get_time_seconds();
+    fprintf(info, "Number of layers: %d\n", num_layers);
 
     // Initialize game state
     struct GameState game_state;
-    game_state.poles = poles;
-    game_state.num_layers = num_layers;
-    game_state.num_moves = 0;
+    exit_on_error(initialize_game_state(&game_state, num_layers, options.num_poles));
+    game_state.headless = options.headless;
+    game_state.delay_ms = options.delay_ms;
+    game_state.color_mode = options.color_mode;
+    game_state.backend = options.backend;
+    game_state.differential = !options.full_redraw;
+    game_state.viewport.mode = options.viewport;
+    if (options.fps > 0) {
+        set_frame_rate(&game_state, options.fps);
+    }
+    struct SplitTable split_table;
+    if (options.engine == ENGINE_FRAME_STEWART) {
+        exit_on_error(initialize_split_table(&split_table, num_layers, options.num_poles));
+        game_state.split_table = &split_table;
+        game_state.total_moves = split_table.moves[split_index(&split_table, num_layers, options.num_poles)];
+    }
+    if (options.engine == ENGINE_CONFIGURATION) {
+        if (options.initial != NULL) {
+            exit_on_error(set_configuration(&game_state, initial));
+        }
+        game_state.goal = goal;
+        game_state.total_moves = configuration_moves(&game_state);
+    }
 
-    draw(game_state);
-    solve_hanoi(&game_state);
+    if (options.seek) {
+        exit_on_error(set_state_at_move(&game_state, options.seek_move));
+    }
+    if (options.resume != NULL) {
+        enum HanoiError error = restore_checkpoint(&game_state, checkpoint);
+        destroy_checkpoint(&checkpoint);
+        exit_on_error(error);
+        print_move_count(info, "Resuming after move", game_state.num_moves);
+    }
+    struct Checkpointer checkpointer;
+    if (options.checkpoint != NULL) {
+        exit_on_error(start_checkpointer(&checkpointer, options.checkpoint, options.checkpoint_interval,
+                                         &game_state));
+    }
 
-    destroy_poles(poles);
+    if (options.headless) {
+        struct MoveLog move_log;
+        if (options.output != NULL) {
+            exit_on_error(open_move_log(&move_log, options.output, options.output_format, game_state));
+            game_state.move_log = &move_log;
+        }
+        double start = get_time_seconds();
+        enum HanoiError error = solve_hanoi(&game_state, options.engine, options.num_threads);
+        if (options.checkpoint != NULL) {
+            finish_checkpoints(&game_state);
+        }
+        if (options.output != NULL) {
+            // The log failing stops the solve, so the first error is the same either way
+            enum HanoiError log_error = close_move_log(&move_log);
+            if (error == HANOI_OK) {
+                error = log_error;
+            }
+        }
+        exit_on_error(error);
+        double elapsed = get_time_seconds() - start;
+        print_move_count(info, "Moves", game_state.num_moves);
+        fprintf(info, "Checksum: %016llx\n", game_state.checksum);
+        fprintf(info, "Solved: %s\n", is_solved(game_state) ? "yes" : "no");
+        fprintf(info, "Time: %.6f s\n", elapsed);
+        if (options.stats) {
+            print_stats(info, elapsed, startup_time);
+        }
+    } else if (options.render_thread) {
+        struct ColorMap colormap = get_colormap(options.colormap);
+        double start = get_time_seconds();
+        enum HanoiError error = solve_with_render_thread(&game_state, options.engine, options.num_threads,
+                                                         options.render_policy, colormap);
+        double elapsed = get_time_seconds() - start;
+        if (options.checkpoint != NULL) {
+            finish_checkpoints(&game_state);
+        }
+        exit_on_error(error);
+        release_colormap(colormap, options.colormap);
+        if (options.stats) {
+            print_stats(info, elapsed, startup_time);
+        }
+    } else {
+        // Rendering is not needed when headless
+        struct ColorMap colormap = get_colormap(options.colormap);
+        exit_on_error(initialize_rendering(&game_state, colormap));
+        release_colormap(colormap, options.colormap);
+        double start = get_time_seconds();
+        draw(game_state);
+        enum HanoiError error = solve_hanoi(&game_state, options.engine, options.num_threads);
+        if (error == HANOI_OK) {
+            finish_animation(game_state);
+            error = game_state.frame_buffer->error;
+        }
+        double elapsed = get_time_seconds() - start;
+        if (options.checkpoint != NULL) {
+            finish_checkpoints(&game_state);
+        }
+        exit_on_error(error);
+        destroy_rendering(&game_state);
+        if (options.stats) {
+            print_stats(info, elapsed, startup_time);
+        }
+    }
+    if (options.engine == ENGINE_FRAME_STEWART) {
+        destroy_split_table(&split_table);
+    }
+    destroy_game_state(&game_state);
 }